@@ -37,18 +37,31 @@ asynSetMinTimerPeriod(0.001)
 # Uncomment the following line to set it in the IOC.
 #epicsEnvSet("EPICS_CA_MAX_ARRAY_BYTES", "10000000")
 
+# Allocate the frame buffers of all cameras and plugins from large pages
+# (requires the "Lock pages in memory" right); must come before PhotronConfig
+#!PhotronLargePagesConfig(1)
+
 # Create a Photron driver
 # PhotronConfig(const char *portName, const char *ipAddress, int autoDetect, 
-#                   int maxBuffers, int maxMemory, int priority, int stackSize)
+#                   int maxBuffers, int maxMemory, int priority, int stackSize,
+#                   int maxHeads)
 # Search for the camera
 #!PhotronConfig("$(PORT)", "192.168.0.0", 1, 2, 0, 0)
 # Specify the IP address of the camera
 #!PhotronConfig("$(PORT)", "192.168.0.10", 0, 2, 0, 0)
 # If plugins can't keep up and enabling blocking isn't ideal, increase the number of buffers
 PhotronConfig("$(PORT)", "192.168.0.10", 0, 20, 0, 0)
+# Use up to 4 heads of a multi-head system; head N is address N-1
+#!PhotronConfig("$(PORT)", "192.168.0.10", 0, 20, 0, 0, 0, 4)
+# Limit the number of cameras reading out at once and their total bandwidth (MB/s)
+#!PhotronReadoutConfig(1, 0)
+# Number of threads compressing frames when Compress is LZ4 or BSLZ4
+#!PhotronCompressConfig(4)
 # Load the detector records
 dbLoadRecords("$(ADPHOTRON)/db/Photron.template","P=$(PREFIX),R=cam1:,PORT=$(PORT),ADDR=0,TIMEOUT=1")
 dbLoadTemplate("templates/photronExtIO.substitutions")
+# Load the records of the other heads of a multi-head system
+#!dbLoadRecords("$(ADPHOTRON)/db/PhotronHead.template","P=$(PREFIX),R=cam1:head2:,PORT=$(PORT),ADDR=1,TIMEOUT=1")
 # Load support for waiting for readout to comlete when scanning with multiple recordings
 dbLoadRecords("$(TOP)/photronApp/Db/readoutBusy.db","P=$(PREFIX),R=cam1:")
 
@@ -28,6 +28,8 @@
 #include <osiSock.h>
 #include <iocsh.h>
 #include <epicsExit.h>
+#include <epicsAtomic.h>
+#include <initHooks.h>
 
 #include "ADDriver.h"
 #include <epicsExport.h>
@@ -35,12 +37,648 @@
 
 #include <windows.h>
 
+#ifdef HAVE_BITSHUFFLE
+#include <lz4.h>
+#include <bitshuffle.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
 static const char *driverName = "Photron";
 
 static int PDCLibInitialized=0;
 
 static ELLLIST *cameraList;
 
+/* Cameras connect in parallel. Opening and closing a device change the SDK's
+   device table, and an auto-detect search listens for the replies of every
+   camera on the subnet, so only those calls are made one camera at a time */
+static epicsMutexId connectMutex;
+static void photronInitHook(initHookState state);
+
+/* The readout scheduler is shared by all cameras in the IOC. Readouts wait in
+   readoutQueue, highest priority first, until fewer than readoutMaxActive 
+   readouts are running. While running, a readout is paced to its share of 
+   readoutMaxMBps. Both limits are set by PhotronReadoutConfig; 0 means 
+   unlimited. */
+static epicsMutexId readoutMutex;
+static ELLLIST readoutQueue;
+static int readoutMaxActive=0;
+static double readoutMaxMBps=0.0;
+static int readoutActive=0;
+static int readoutActiveShares=0;
+static double readoutTotalRate=0.0;
+
+// A lossless readout waiting for the plugins is woken by the release of a
+// readout array; the timeout only bounds the wait if a signal is missed (s)
+#define STALL_WAIT_TIMEOUT 1.0
+
+/* Compression pool, shared by the cameras of the IOC. Its size is set by 
+   PhotronCompressConfig; the threads are started when a camera first 
+   compresses a frame. */
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ4 1
+#define COMPRESS_BSLZ4 2
+#define COMPRESS_MAX_THREADS 16
+// Period of the compression ratio and speed updates
+#define COMPRESS_STATS_PERIOD 1.0
+static epicsMutexId compressPoolMutex;
+static epicsEventId compressPoolEventId;
+static ELLLIST compressQueue;
+static int compressNumThreads=2;
+static int compressThreadsRunning=0;
+
+/* A camera being armed by the group controller */
+typedef struct {
+  Photron *pCamera;
+  epicsEventId doneEventId;
+  asynStatus status;
+} groupArmJob;
+
+/* GroupArm and GroupTrigger are queued for the group controller thread, so
+   the port they were written to isn't held up while the group arms */
+typedef struct {
+  ELLNODE node;
+  int group;
+  int trigger;
+} groupRequest;
+static epicsMutexId groupMutex;
+static epicsEventId groupEventId;
+static ELLLIST groupQueue;
+
+/* IRIG clock model */
+// Minimum time between (IRIG, host) samples
+#define IRIG_SAMPLE_PERIOD 1.0
+// Samples needed before the drift is fitted
+#define IRIG_MIN_FIT_SAMPLES 10
+// A sample that disagrees with the model by more than this means the IRIG 
+// clock jumped (it was reset or the day of year rolled over)
+#define IRIG_MAX_ERROR 1.0
+
+// Playback repeat modes (PMRepeat)
+#define PLAY_REPEAT_OFF 0
+#define PLAY_REPEAT_LOOP 1
+#define PLAY_REPEAT_PING_PONG 2
+
+// Longest wait of the live grabber for the camera's next frame (s)
+#define GRAB_POLL_MAX 0.01
+
+// How often a readout waiting for the readout scheduler checks for an abort (s)
+#define READOUT_QUEUE_POLL 0.1
+
+// How long the group controller waits for the cameras of a group to arm (s)
+#define GROUP_ARM_TIMEOUT 10.0
+// How often the camera status is read while a camera arms (s)
+#define GROUP_ARM_POLL 0.002
+
+// Result of GroupArm and GroupTrigger
+#define GROUP_STATUS_IDLE 0
+#define GROUP_STATUS_ARMING 1
+#define GROUP_STATUS_ARMED 2
+#define GROUP_STATUS_TRIGGERED 3
+#define GROUP_STATUS_TIMEOUT 4
+#define GROUP_STATUS_ERROR 5
+
+/* Connection supervisor */
+// How often the link is checked while the camera is idle (s)
+#define SUPERVISOR_PERIOD 1.0
+// A status poll that takes longer than this means the link is lost (s)
+#define STATUS_POLL_TIMEOUT 2.0
+// Delay before the first reconnect attempt, doubled after every failed 
+// attempt up to the maximum (s)
+#define RECONNECT_MIN_DELAY 1.0
+#define RECONNECT_MAX_DELAY 60.0
+// Values of ConnectState
+#define CONNECT_STATE_DISCONNECTED 0
+#define CONNECT_STATE_CONNECTING 1
+#define CONNECT_STATE_CONNECTED 2
+
+// Number of frames of MCDL data to read per SDK call
+#define MCDL_CHUNK_FRAMES 1000
+// Samples of each MCDL channel per frame, the size of the PDC_MCDL_INFO 
+// arrays
+#define MCDL_SAMPLES 10
+
+// What the frame times of a recording are anchored to
+#define FRAME_TIME_NONE 0
+#define FRAME_TIME_USER 1
+#define FRAME_TIME_REC_START 2
+#define FRAME_TIME_REC_END 3
+
+/* Frame buffers allocated with VirtualAlloc are preceded by a header that 
+   marks them; heap buffers have no header. This lets the free function tell
+   them apart, including heap buffers that a pool allocated before the 
+   functions were installed. The header size preserves the alignment of the
+   underlying allocation. */
+#define FRAME_HEADER_SIZE 128
+#define FRAME_HEADER_MAGIC 0x50484F54
+#define FRAME_REGION_ALIGN 0x10000
+#define FRAME_MEM_LARGE_PAGES 1
+#define FRAME_MEM_LOCKED_PAGES 2
+
+typedef struct {
+  epicsUInt32 magic;
+  epicsUInt32 kind;
+} frameHeader;
+
+static int largePagesChecked=0;
+static int largePagesEnabled=0;
+static size_t largePageSize=0;
+static size_t largePageAllocs=0;
+static size_t lockedPageAllocs=0;
+
+/* SIMD kernels are compiled for SSE4.1 and AVX2 and chosen at run time, so 
+   the driver runs on any x64 CPU. MSVC accepts the intrinsics without 
+   /arch; gcc needs the target attribute. */
+#if defined(_MSC_VER)
+#define PHOTRON_TARGET(isa)
+#else
+#define PHOTRON_TARGET(isa) __attribute__((target(isa)))
+#endif
+#define SIMD_SCALAR 0
+#define SIMD_SSE41 1
+#define SIMD_AVX2 2
+
+static int simdLevel=-1;
+
+/* Frame correction */
+// Fraction bits of the flat-field gain
+#define CORR_GAIN_SHIFT 12
+#define CORR_GAIN_ONE (1 << CORR_GAIN_SHIFT)
+#define CORR_MODE_OFF 0
+#define CORR_MODE_DARK 1
+#define CORR_MODE_DARK_FLAT 2
+#define CORR_OUTPUT_UINT16 0
+#define CORR_OUTPUT_FLOAT32 1
+// Fills the pixel gain buffer beyond the current resolution, to detect 
+// whether the camera wrote a table of another size
+#define PIXEL_GAIN_GUARD 0xA5A5
+
+
+/** Allocates memory for frame buffers. Buffers at least as large as a large 
+  * page (2 MB on x64) come from locked, large-page-backed memory, which 
+  * reduces TLB misses and page faults while the SDK and the plugins stream 
+  * through multi-megabyte frames. If a large-page allocation fails, e.g. 
+  * because physical memory is fragmented, the buffer is allocated from normal
+  * pages, which are locked in memory if possible. Smaller buffers, and all 
+  * buffers when large pages aren't enabled, are allocated from the heap.
+  */
+static void *photronFrameMalloc(size_t size) {
+  char *pMem;
+  size_t allocSize;
+  frameHeader *pHeader;
+  int kind = FRAME_MEM_LARGE_PAGES;
+  
+  if (!largePagesEnabled || (size < largePageSize)) {
+    return malloc(size);
+  }
+  
+  // Large-page allocations must be a multiple of the large page size
+  allocSize = size + FRAME_HEADER_SIZE;
+  allocSize = ((allocSize + largePageSize - 1) / largePageSize) * largePageSize;
+  pMem = (char *)VirtualAlloc(NULL, allocSize, 
+                              MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                              PAGE_READWRITE);
+  if (pMem) {
+    epicsAtomicIncrSizeT(&largePageAllocs);
+  } else {
+    // Fall back to normal pages
+    kind = FRAME_MEM_LOCKED_PAGES;
+    allocSize = size + FRAME_HEADER_SIZE;
+    pMem = (char *)VirtualAlloc(NULL, allocSize, MEM_RESERVE | MEM_COMMIT,
+                                PAGE_READWRITE);
+    if (!pMem) {
+      return malloc(size);
+    }
+    // Failing to lock the pages isn't an error; they just remain pageable
+    if (VirtualLock(pMem, allocSize)) {
+      epicsAtomicIncrSizeT(&lockedPageAllocs);
+    }
+  }
+  
+  pHeader = (frameHeader *)pMem;
+  pHeader->magic = FRAME_HEADER_MAGIC;
+  pHeader->kind = kind;
+  return (void *)(pMem + FRAME_HEADER_SIZE);
+}
+
+
+/** Frees memory allocated with photronFrameMalloc or with malloc. A buffer
+  * came from VirtualAlloc if its region starts with a header right before 
+  * it; nothing outside the buffer is read unless the region begins there.
+  * VirtualAlloc regions start on the allocation granularity (64 kB), so heap
+  * buffers are almost always freed without calling VirtualQuery.
+  */
+static void photronFrameFree(void *ptr) {
+  char *pMem;
+  MEMORY_BASIC_INFORMATION info;
+  
+  if (!ptr) {
+    return;
+  }
+  
+  pMem = (char *)ptr - FRAME_HEADER_SIZE;
+  if ((((size_t)pMem & (FRAME_REGION_ALIGN - 1)) == 0) &&
+      (VirtualQuery(ptr, &info, sizeof(info)) == sizeof(info)) &&
+      (info.AllocationBase == (void *)pMem) &&
+      (((frameHeader *)pMem)->magic == FRAME_HEADER_MAGIC)) {
+    // Releasing the region also unlocks it
+    VirtualFree(pMem, 0, MEM_RELEASE);
+  } else {
+    free(ptr);
+  }
+}
+
+
+/** Returns the best instruction set the CPU supports for the SIMD kernels */
+static int getSimdLevel() {
+  int sse41, avx2;
+#if defined(_MSC_VER)
+  int info[4];
+  int numIds;
+#endif
+  
+  if (simdLevel >= 0) {
+    return simdLevel;
+  }
+  
+#if defined(_MSC_VER)
+  __cpuid(info, 0);
+  numIds = info[0];
+  __cpuid(info, 1);
+  sse41 = (info[2] >> 19) & 1;
+  avx2 = 0;
+  // AVX2 also needs the OS to save the YMM registers (OSXSAVE and XCR0)
+  if ((numIds >= 7) && ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) &&
+      ((_xgetbv(0) & 6) == 6)) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] >> 5) & 1;
+  }
+#else
+  __builtin_cpu_init();
+  sse41 = __builtin_cpu_supports("sse4.1");
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+  
+  if (avx2) {
+    simdLevel = SIMD_AVX2;
+  } else if (sse41) {
+    simdLevel = SIMD_SSE41;
+  } else {
+    simdLevel = SIMD_SCALAR;
+  }
+  return simdLevel;
+}
+
+
+/** Subtracts the dark reference from a 16-bit frame and multiplies by the 
+  * gain, either of which may be NULL. The result is clamped to 0-65535. 
+  * These kernels may work in place (pOut == pRaw). */
+static void correctU16Scalar(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                             const epicsUInt16 *pGain, epicsUInt16 *pOut, 
+                             size_t count) {
+  size_t i;
+  epicsUInt32 value;
+  
+  for (i=0; i<count; i++) {
+    value = pRaw[i];
+    if (pDark) {
+      value = (value > pDark[i]) ? (value - pDark[i]) : 0;
+    }
+    if (pGain) {
+      value = (value * pGain[i] + (CORR_GAIN_ONE >> 1)) >> CORR_GAIN_SHIFT;
+      if (value > 65535) {
+        value = 65535;
+      }
+    }
+    pOut[i] = (epicsUInt16)value;
+  }
+}
+
+PHOTRON_TARGET("sse4.1")
+static void correctU16SSE41(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                            const epicsUInt16 *pGain, epicsUInt16 *pOut, 
+                            size_t count) {
+  size_t i = 0;
+  __m128i raw, dark, gain, lo, hi, p0, p1;
+  const __m128i round = _mm_set1_epi32(CORR_GAIN_ONE >> 1);
+  
+  for (; i+8<=count; i+=8) {
+    raw = _mm_loadu_si128((const __m128i *)(pRaw + i));
+    if (pDark) {
+      // Saturating subtraction clamps at 0
+      dark = _mm_loadu_si128((const __m128i *)(pDark + i));
+      raw = _mm_subs_epu16(raw, dark);
+    }
+    if (pGain) {
+      // 32-bit products from the low and high halves of the 16x16 products
+      gain = _mm_loadu_si128((const __m128i *)(pGain + i));
+      lo = _mm_mullo_epi16(raw, gain);
+      hi = _mm_mulhi_epu16(raw, gain);
+      p0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round);
+      p1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round);
+      p0 = _mm_srli_epi32(p0, CORR_GAIN_SHIFT);
+      p1 = _mm_srli_epi32(p1, CORR_GAIN_SHIFT);
+      raw = _mm_packus_epi32(p0, p1);
+    }
+    _mm_storeu_si128((__m128i *)(pOut + i), raw);
+  }
+  correctU16Scalar(pRaw + i, pDark ? (pDark + i) : NULL, 
+                   pGain ? (pGain + i) : NULL, pOut + i, count - i);
+}
+
+PHOTRON_TARGET("avx2")
+static void correctU16AVX2(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                           const epicsUInt16 *pGain, epicsUInt16 *pOut, 
+                           size_t count) {
+  size_t i = 0;
+  __m256i raw, dark, gain, lo, hi, p0, p1;
+  const __m256i round = _mm256_set1_epi32(CORR_GAIN_ONE >> 1);
+  
+  // The unpack and pack instructions work within 128-bit lanes, so the 
+  // pixels stay in order
+  for (; i+16<=count; i+=16) {
+    raw = _mm256_loadu_si256((const __m256i *)(pRaw + i));
+    if (pDark) {
+      dark = _mm256_loadu_si256((const __m256i *)(pDark + i));
+      raw = _mm256_subs_epu16(raw, dark);
+    }
+    if (pGain) {
+      gain = _mm256_loadu_si256((const __m256i *)(pGain + i));
+      lo = _mm256_mullo_epi16(raw, gain);
+      hi = _mm256_mulhi_epu16(raw, gain);
+      p0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round);
+      p1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round);
+      p0 = _mm256_srli_epi32(p0, CORR_GAIN_SHIFT);
+      p1 = _mm256_srli_epi32(p1, CORR_GAIN_SHIFT);
+      raw = _mm256_packus_epi32(p0, p1);
+    }
+    _mm256_storeu_si256((__m256i *)(pOut + i), raw);
+  }
+  correctU16Scalar(pRaw + i, pDark ? (pDark + i) : NULL, 
+                   pGain ? (pGain + i) : NULL, pOut + i, count - i);
+}
+
+/** Runs the fastest UInt16 correction kernel the CPU supports */
+static void correctU16(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                       const epicsUInt16 *pGain, epicsUInt16 *pOut, 
+                       size_t count) {
+  if (getSimdLevel() >= SIMD_AVX2) {
+    correctU16AVX2(pRaw, pDark, pGain, pOut, count);
+  } else if (getSimdLevel() >= SIMD_SSE41) {
+    correctU16SSE41(pRaw, pDark, pGain, pOut, count);
+  } else {
+    correctU16Scalar(pRaw, pDark, pGain, pOut, count);
+  }
+}
+
+
+/** Float32 versions of the correction kernels. Values below the dark 
+  * reference stay negative. */
+static void correctF32Scalar(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                             const epicsUInt16 *pGain, epicsFloat32 *pOut, 
+                             size_t count) {
+  size_t i;
+  const epicsFloat32 scale = 1.0f / CORR_GAIN_ONE;
+  
+  for (i=0; i<count; i++) {
+    pOut[i] = (epicsFloat32)pRaw[i] - (epicsFloat32)pDark[i];
+    if (pGain) {
+      pOut[i] *= pGain[i] * scale;
+    }
+  }
+}
+
+PHOTRON_TARGET("avx2")
+static void correctF32AVX2(const epicsUInt16 *pRaw, const epicsUInt16 *pDark,
+                           const epicsUInt16 *pGain, epicsFloat32 *pOut, 
+                           size_t count) {
+  size_t i = 0;
+  __m256 value, gain;
+  const __m256 scale = _mm256_set1_ps(1.0f / CORR_GAIN_ONE);
+  
+  for (; i+8<=count; i+=8) {
+    value = _mm256_sub_ps(
+      _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pRaw + i)))),
+      _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pDark + i)))));
+    if (pGain) {
+      gain = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pGain + i))));
+      value = _mm256_mul_ps(value, _mm256_mul_ps(gain, scale));
+    }
+    _mm256_storeu_ps(pOut + i, value);
+  }
+  correctF32Scalar(pRaw + i, pDark + i, pGain ? (pGain + i) : NULL, pOut + i,
+                   count - i);
+}
+
+
+/* Bilinear demosaic of Bayer data. Every row of a Bayer mosaic holds green 
+   and one other color, called the row color here, which alternates 
+   between red and blue from row to row. At the row color pixels green is 
+   the mean of the 4 nearest pixels and the third color the mean of the 4 
+   diagonal ones; at the green pixels the row color is the mean of the 
+   horizontal and the third color of the vertical neighbours. Means are 
+   formed from rounded pairwise averages so the SIMD and scalar versions 
+   give the same result. The edges are mirrored, which keeps the pattern. */
+#define BAYER_AVG(a, b) (((epicsUInt32)(a) + (b) + 1) >> 1)
+
+template <typename epicsType>
+static void demosaicRowScalar(const epicsType *pUp, const epicsType *pRow,
+                              const epicsType *pDown, int width, int x0, 
+                              int x1, int colorParity, epicsType *pRowColor,
+                              epicsType *pGreen, epicsType *pOtherColor) {
+  int x, left, right;
+  epicsUInt32 horiz, vert, cross, diag;
+  
+  for (x=x0; x<x1; x++) {
+    left = (x > 0) ? (x - 1) : 1;
+    right = (x < width - 1) ? (x + 1) : (width - 2);
+    horiz = BAYER_AVG(pRow[left], pRow[right]);
+    vert = BAYER_AVG(pUp[x], pDown[x]);
+    cross = BAYER_AVG(horiz, vert);
+    diag = BAYER_AVG(BAYER_AVG(pUp[left], pUp[right]), 
+                     BAYER_AVG(pDown[left], pDown[right]));
+    if ((x & 1) == colorParity) {
+      pRowColor[x] = pRow[x];
+      pGreen[x] = (epicsType)cross;
+      pOtherColor[x] = (epicsType)diag;
+    } else {
+      pRowColor[x] = (epicsType)horiz;
+      pGreen[x] = pRow[x];
+      pOtherColor[x] = (epicsType)vert;
+    }
+  }
+}
+
+/* Interior pixels of a 16-bit row, 8 at a time. x0 must be even and the 
+   neighbours of x1-1 must exist. SSE2 is part of x64, so this needs no 
+   run-time check. Returns the first pixel that wasn't done. */
+static int demosaicRowSIMD(const epicsUInt16 *pUp, const epicsUInt16 *pRow,
+                           const epicsUInt16 *pDown, int x0, int x1, 
+                           int colorParity, epicsUInt16 *pRowColor,
+                           epicsUInt16 *pGreen, epicsUInt16 *pOtherColor) {
+  int x;
+  __m128i center, horiz, vert, cross, diag, out;
+  // Selects the lanes of the row color pixels
+  const __m128i mask = colorParity ? _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0)
+                                   : _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+  
+  for (x=x0; x+8<=x1; x+=8) {
+    center = _mm_loadu_si128((const __m128i *)(pRow + x));
+    horiz = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(pRow + x - 1)),
+                          _mm_loadu_si128((const __m128i *)(pRow + x + 1)));
+    vert = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(pUp + x)),
+                         _mm_loadu_si128((const __m128i *)(pDown + x)));
+    cross = _mm_avg_epu16(horiz, vert);
+    diag = _mm_avg_epu16(
+             _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(pUp + x - 1)),
+                           _mm_loadu_si128((const __m128i *)(pUp + x + 1))),
+             _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(pDown + x - 1)),
+                           _mm_loadu_si128((const __m128i *)(pDown + x + 1))));
+    out = _mm_or_si128(_mm_and_si128(mask, center), 
+                       _mm_andnot_si128(mask, horiz));
+    _mm_storeu_si128((__m128i *)(pRowColor + x), out);
+    out = _mm_or_si128(_mm_and_si128(mask, cross), 
+                       _mm_andnot_si128(mask, center));
+    _mm_storeu_si128((__m128i *)(pGreen + x), out);
+    out = _mm_or_si128(_mm_and_si128(mask, diag), 
+                       _mm_andnot_si128(mask, vert));
+    _mm_storeu_si128((__m128i *)(pOtherColor + x), out);
+  }
+  return x;
+}
+
+/* Pixels x0 to x1-1 of a row, where x0 is at least 2. 8-bit rows are 
+   interpolated by the scalar code. */
+static void demosaicRowInterior(const epicsUInt8 *pUp, const epicsUInt8 *pRow,
+                                const epicsUInt8 *pDown, int width, int x0, 
+                                int x1, int colorParity, epicsUInt8 *pRowColor,
+                                epicsUInt8 *pGreen, epicsUInt8 *pOtherColor) {
+  demosaicRowScalar(pUp, pRow, pDown, width, x0, x1, colorParity, pRowColor,
+                    pGreen, pOtherColor);
+}
+
+/* 16-bit rows use the SIMD code up to the last pixel, which needs a mirrored
+   neighbour */
+static void demosaicRowInterior(const epicsUInt16 *pUp, const epicsUInt16 *pRow,
+                                const epicsUInt16 *pDown, int width, int x0,
+                                int x1, int colorParity, epicsUInt16 *pRowColor,
+                                epicsUInt16 *pGreen, epicsUInt16 *pOtherColor) {
+  int done;
+  
+  done = demosaicRowSIMD(pUp, pRow, pDown, x0, x1 - 1, colorParity, 
+                         pRowColor, pGreen, pOtherColor);
+  if (done < x0) {
+    done = x0;
+  }
+  demosaicRowScalar(pUp, pRow, pDown, width, done, x1, colorParity, pRowColor,
+                    pGreen, pOtherColor);
+}
+
+/** Converts a Bayer image of at least 2x2 pixels to RGB1. pScratch holds 
+  * 3 rows. */
+template <typename epicsType>
+static void demosaicBilinear(const epicsType *pIn, epicsType *pOut, int width,
+                             int height, int pattern, epicsType *pScratch) {
+  int x, y, up, down, redRow, colorParity;
+  const epicsType *pRow;
+  epicsType *pRowColor = pScratch;
+  epicsType *pGreen = pScratch + width;
+  epicsType *pOtherColor = pScratch + 2 * width;
+  epicsType *pRed, *pBlue, *pDest;
+  // Colors of the first row
+  int redRow0 = (pattern == NDBayerRGGB) || (pattern == NDBayerGRBG);
+  int colorParity0 = (pattern == NDBayerRGGB) || (pattern == NDBayerBGGR) ? 0 : 1;
+  
+  for (y=0; y<height; y++) {
+    up = (y > 0) ? (y - 1) : 1;
+    down = (y < height - 1) ? (y + 1) : (height - 2);
+    redRow = (y & 1) ? !redRow0 : redRow0;
+    colorParity = (y & 1) ? !colorParity0 : colorParity0;
+    pRow = pIn + (size_t)y * width;
+    
+    // The first two and the last pixels need mirrored neighbours
+    demosaicRowScalar(pIn + (size_t)up * width, pRow, 
+                      pIn + (size_t)down * width, width, 0, 
+                      (width < 2) ? width : 2, colorParity, pRowColor, 
+                      pGreen, pOtherColor);
+    demosaicRowInterior(pIn + (size_t)up * width, pRow, 
+                        pIn + (size_t)down * width, width, 2, width, 
+                        colorParity, pRowColor, pGreen, pOtherColor);
+    
+    pRed = redRow ? pRowColor : pOtherColor;
+    pBlue = redRow ? pOtherColor : pRowColor;
+    pDest = pOut + (size_t)y * width * 3;
+    for (x=0; x<width; x++) {
+      pDest[3*x] = pRed[x];
+      pDest[3*x+1] = pGreen[x];
+      pDest[3*x+2] = pBlue[x];
+    }
+  }
+}
+
+
+/** Enables the SeLockMemoryPrivilege, which is required to allocate large
+  * pages, and if that succeeds installs the frame allocator in the 
+  * NDArrayPool. The allocator is used by every NDArrayPool in the IOC, so 
+  * this is only called by PhotronLargePagesConfig.
+  * Returns 1 if large pages can be used, 0 if normal pages will be used.
+  */
+static int enableLargePages() {
+  HANDLE hToken;
+  TOKEN_PRIVILEGES tp;
+  BOOL success;
+  DWORD err;
+  
+  if (largePagesChecked) {
+    return largePagesEnabled;
+  }
+  largePagesChecked = 1;
+  
+  largePageSize = GetLargePageMinimum();
+  
+  if (largePageSize > 0) {
+    if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY,
+                         &hToken)) {
+      tp.PrivilegeCount = 1;
+      tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+      success = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &(tp.Privileges[0].Luid));
+      if (success) {
+        success = AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL);
+        // AdjustTokenPrivileges succeeds even if the privilege wasn't granted
+        err = GetLastError();
+        if (err == ERROR_NOT_ALL_ASSIGNED) {
+          success = FALSE;
+        }
+      }
+      CloseHandle(hToken);
+    } else {
+      success = FALSE;
+    }
+    
+    if (!success) {
+      printf("%s: the \"Lock pages in memory\" right is required for large pages; using normal pages\n",
+             driverName);
+      largePageSize = 0;
+    }
+  } else {
+    printf("%s: large pages aren't supported; using normal pages\n", driverName);
+  }
+  
+  if (largePageSize == 0) {
+    return 0;
+  }
+  
+  largePagesEnabled = 1;
+  NDArrayPool::setDefaultFrameMemoryFunctions(photronFrameMalloc, photronFrameFree);
+  
+  return 1;
+}
+
 
 /** Constructor for Photron; most parameters are simply passed to ADDriver::ADDriver.
   * After calling the base class constructor this method creates a thread to compute the simulated detector data,
@@ -57,13 +695,21 @@ static ELLLIST *cameraList;
   *            and maxBuffers is, say 14. maxMemory = 1024x768x14 = 11010048 bytes (~11MB). 0=unlimited.
   * \param[in] priority The EPICS thread priority for this driver.  0=use asyn default.
   * \param[in] stackSize The size of the stack for the EPICS port thread. 0=use asyn default.
+  * \param[in] maxHeads Maximum number of camera heads of a multi-head system.
+  *            Head N is asyn address N-1. Values below 2 use only the first head.
+  *            Live images, the preview and playback only use the first head; 
+  *            the others are read out from memory, and only their ADSizeX and
+  *            ADSizeY can be written.
   */
   
 Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
-                 int maxBuffers, size_t maxMemory, int priority, int stackSize)
-    : ADDriver(portName, 1, NUM_PHOTRON_PARAMS, maxBuffers, maxMemory,
+                 int maxBuffers, size_t maxMemory, int priority, int stackSize,
+                 int maxHeads)
+    : ADDriver(portName, (maxHeads > 1) ? maxHeads : 1, NUM_PHOTRON_PARAMS, 
+               maxBuffers, maxMemory,
                asynEnumMask, asynEnumMask, /* asynEnum interface for dynamic mbbi/o */
-               0, 0, /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               (maxHeads > 1) ? ASYN_MULTIDEVICE : 0, /* ASYN_CANBLOCK=0 */
+               0, /* autoConnect=0 */
                priority, stackSize),
       pRaw(NULL) {
   int status = asynSuccess;
@@ -74,6 +720,9 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
  
   this->cameraId = epicsStrDup(ipAddress);
   this->autoDetect = autoDetect;
+  this->maxHeads = (maxHeads > 1) ? maxHeads : 1;
+  this->numHeads = 1;
+  this->headChildNo[0] = 1;
   // Initialize the bitDepth for asynReport in case the feature isn't supported
   this->bitDepth = 0;
 
@@ -81,8 +730,25 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
   if (!cameraList) {
     cameraList = new ELLLIST;
     ellInit(cameraList);
+    ellInit(&readoutQueue);
+    readoutMutex = epicsMutexCreate();
+    connectMutex = epicsMutexCreate();
+    initHookRegister(photronInitHook);
+    ellInit(&compressQueue);
+    compressPoolMutex = epicsMutexCreate();
+    compressPoolEventId = epicsEventCreate(epicsEventEmpty);
+    ellInit(&groupQueue);
+    groupMutex = epicsMutexCreate();
+    groupEventId = epicsEventCreate(epicsEventEmpty);
+    if (epicsThreadCreate("PhotronGroupTask", epicsThreadPriorityHigh,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)PhotronGroupTaskC, NULL) == NULL) {
+      printf("%s:%s epicsThreadCreate failure for group controller\n",
+             driverName, functionName);
+    }
   }
   pNode->pCamera = this;
+  pNode->startConnect = 0;
   ellAdd(cameraList, (ELLNODE *)pNode);
 
   // CREATE PARAMS HERE
@@ -167,6 +833,70 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
   createParam(PhotronExtOut4SigString,    asynParamInt32, &PhotronExtOut4Sig);
   createParam(PhotronShadingModeString,   asynParamInt32, &PhotronShadingMode);
   createParam(PhotronBurstTransString,    asynParamInt32, &PhotronBurstTrans);
+  createParam(PhotronReadoutLosslessString, asynParamInt32, &PhotronReadoutLossless);
+  createParam(PhotronReadoutMaxInFlightString, asynParamInt32, &PhotronReadoutMaxInFlight);
+  createParam(PhotronReadoutStallTimeString, asynParamFloat64, &PhotronReadoutStallTime);
+  createParam(PhotronReadoutStallsString, asynParamInt32, &PhotronReadoutStalls);
+  createParam(PhotronReadoutDroppedString, asynParamInt32, &PhotronReadoutDropped);
+  createParam(PhotronReadoutReserveString, asynParamInt32, &PhotronReadoutReserve);
+  createParam(PhotronReadoutReservedBytesString, asynParamFloat64, &PhotronReadoutReservedBytes);
+  createParam(PhotronLiveGrabberString, asynParamInt32, &PhotronLiveGrabber);
+  createParam(PhotronLiveGrabRateString, asynParamFloat64, &PhotronLiveGrabRate);
+  createParam(PhotronLiveDroppedString, asynParamInt32, &PhotronLiveDropped);
+  createParam(PhotronLiveFrameNumbersString, asynParamInt32, &PhotronLiveFrameNumbers);
+  createParam(PhotronLiveFrameNoString, asynParamInt32, &PhotronLiveFrameNo);
+  createParam(PhotronLiveDeliveredRateString, asynParamFloat64, &PhotronLiveDeliveredRate);
+  createParam(PhotronLiveSensorRateString, asynParamFloat64, &PhotronLiveSensorRate);
+  createParam(PhotronLiveSkippedString, asynParamInt32, &PhotronLiveSkipped);
+  createParam(PhotronIRIGResidualString, asynParamFloat64, &PhotronIRIGResidual);
+  createParam(PhotronIRIGDriftString, asynParamFloat64, &PhotronIRIGDrift);
+  createParam(PhotronTrigTimeString, asynParamFloat64, &PhotronTrigTime);
+  createParam(PhotronFrameTimeSourceString, asynParamInt32, &PhotronFrameTimeSource);
+  createParam(PhotronPMCacheBudgetString, asynParamInt32, &PhotronPMCacheBudget);
+  createParam(PhotronPMCacheUsedString, asynParamFloat64, &PhotronPMCacheUsed);
+  createParam(PhotronPMCacheHitRateString, asynParamFloat64, &PhotronPMCacheHitRate);
+  createParam(PhotronPMPrefetchAheadString, asynParamInt32, &PhotronPMPrefetchAhead);
+  createParam(PhotronPMPrefetchBehindString, asynParamInt32, &PhotronPMPrefetchBehind);
+  createParam(PhotronPMAchievedFPSString, asynParamFloat64, &PhotronPMAchievedFPS);
+  createParam(PhotronPMSkippedString, asynParamInt32, &PhotronPMSkipped);
+  createParam(PhotronPMAddRangeString, asynParamInt32, &PhotronPMAddRange);
+  createParam(PhotronPMClearRangesString, asynParamInt32, &PhotronPMClearRanges);
+  createParam(PhotronPMNumRangesString, asynParamInt32, &PhotronPMNumRanges);
+  createParam(PhotronPMRangeFramesString, asynParamInt32, &PhotronPMRangeFrames);
+  createParam(PhotronNumRecordingsString, asynParamInt32, &PhotronNumRecordings);
+  createParam(PhotronSplitRecordingsString, asynParamInt32, &PhotronSplitRecordings);
+  createParam(PhotronSyncGroupString, asynParamInt32, &PhotronSyncGroup);
+  createParam(PhotronGroupArmString, asynParamInt32, &PhotronGroupArm);
+  createParam(PhotronGroupTriggerString, asynParamInt32, &PhotronGroupTrigger);
+  createParam(PhotronGroupArmTimeString, asynParamFloat64, &PhotronGroupArmTime);
+  createParam(PhotronGroupTrigSkewString, asynParamFloat64, &PhotronGroupTrigSkew);
+  createParam(PhotronGroupStatusString, asynParamInt32, &PhotronGroupStatus);
+  createParam(PhotronReadoutPriorityString, asynParamInt32, &PhotronReadoutPriority);
+  createParam(PhotronReadoutShareString, asynParamInt32, &PhotronReadoutShare);
+  createParam(PhotronReadoutWaitTimeString, asynParamFloat64, &PhotronReadoutWaitTime);
+  createParam(PhotronReadoutMBpsString, asynParamFloat64, &PhotronReadoutMBps);
+  createParam(PhotronReadoutTotalMBpsString, asynParamFloat64, &PhotronReadoutTotalMBps);
+  createParam(PhotronConnectTimeString, asynParamFloat64, &PhotronConnectTime);
+  createParam(PhotronConnectStateString, asynParamInt32, &PhotronConnectState);
+  createParam(PhotronAutoReconnectString, asynParamInt32, &PhotronAutoReconnect);
+  createParam(PhotronReconnectCountString, asynParamInt32, &PhotronReconnectCount);
+  createParam(PhotronDowntimeString, asynParamFloat64, &PhotronDowntime);
+  createParam(PhotronNumHeadsString, asynParamInt32, &PhotronNumHeads);
+  createParam(PhotronCorrModeString, asynParamInt32, &PhotronCorrMode);
+  createParam(PhotronCorrOutputString, asynParamInt32, &PhotronCorrOutput);
+  createParam(PhotronCorrFramesString, asynParamInt32, &PhotronCorrFrames);
+  createParam(PhotronCorrCaptureDarkString, asynParamInt32, &PhotronCorrCaptureDark);
+  createParam(PhotronCorrCaptureFlatString, asynParamInt32, &PhotronCorrCaptureFlat);
+  createParam(PhotronCorrClearString, asynParamInt32, &PhotronCorrClear);
+  createParam(PhotronCorrHaveDarkString, asynParamInt32, &PhotronCorrHaveDark);
+  createParam(PhotronCorrHaveFlatString, asynParamInt32, &PhotronCorrHaveFlat);
+  createParam(PhotronCorrTimeString, asynParamFloat64, &PhotronCorrTime);
+  createParam(PhotronPixelGainCorrString, asynParamInt32, &PhotronPixelGainCorr);
+  createParam(PhotronPixelGainLoadedString, asynParamInt32, &PhotronPixelGainLoaded);
+  createParam(PhotronCompressString, asynParamInt32, &PhotronCompress);
+  createParam(PhotronCompressRatioString, asynParamFloat64, &PhotronCompressRatio);
+  createParam(PhotronCompressSpeedString, asynParamFloat64, &PhotronCompressSpeed);
+  createParam(PhotronCompressThreadsString, asynParamInt32, &PhotronCompressThreads);
   
   PhotronExtInSig[0] = &PhotronExtIn1Sig;
   PhotronExtInSig[1] = &PhotronExtIn2Sig;
@@ -191,6 +921,54 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
   
   this->abortFlag = 0;
   this->forceWait = 0;
+  this->reservedBytes = 0;
+  this->reserveBufferSize = 0;
+  this->liveLatest = NULL;
+  this->liveFrameValid = 0;
+  this->liveFrameNo = 0;
+  this->frameDataStart = 0;
+  this->frameDataCount = 0;
+  this->mcdlData = NULL;
+  this->exposeData = NULL;
+  this->exposeDataCount = 0;
+  this->recStartValid = 0;
+  epicsTimeGetCurrent(&(this->frameAnchorTime));
+  this->frameAnchorFrame = 0;
+  ellInit(&(this->previewCache));
+  ellInit(&(this->correctionRefs));
+  this->corrMutex = epicsMutexCreate();
+  this->colorMutex = epicsMutexCreate();
+  this->colorScratch = NULL;
+  this->colorScratchSize = 0;
+  // Mono until the camera reports its color type
+  this->colorType = PDC_COLORTYPE_MONO;
+  this->bayerPattern = NDBayerRGGB;
+  getSimdLevel();
+  this->previewCacheBytes = 0;
+  this->previewCacheHits = 0;
+  this->previewCacheMisses = 0;
+  this->prefetchIndex = 0;
+  this->prefetchDir = 1;
+  this->prefetchGeneration = 0;
+  this->prefetchBusy = 0;
+  this->grabBusy = 0;
+  this->armBusy = 0;
+  this->playActive = 0;
+  this->playScheduleChanged = 1;
+  this->numSaveRanges = 0;
+  this->numRecordings = 0;
+  
+  // Until IRIG is enabled, the model is anchored at the time the IOC started
+  epicsTimeGetCurrent(&(this->postIRIGStartTime));
+  this->preIRIGStartTime = this->postIRIGStartTime;
+  resetIRIGModel();
+  
+  this->liveMutex = epicsMutexCreate();
+  if (!this->liveMutex) {
+    printf("%s:%s epicsMutexCreate failure for live mutex\n",
+           driverName, functionName);
+    return;
+  }
   
   /* Create the epicsEvents for signaling to the acquisition task when 
      acquisition starts and stops */
@@ -259,6 +1037,134 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
     return;
   }
   
+  // Create an epicsEvent for waking up a lossless readout that is waiting 
+  // for the plugins to release buffers
+  this->freeBufferEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->freeBufferEventId) {
+    printf("%s:%s epicsEventCreate failure for free buffer event\n",
+           driverName, functionName);
+    return;
+  }
+  // The reserved buffers aren't limited by maxMemory; the other readout 
+  // arrays are, like the arrays of the driver's pool
+  this->pReservePool = new PhotronArrayPool(this, 0, this->freeBufferEventId);
+  this->pReadoutPool = new PhotronArrayPool(this, maxMemory, 
+                                            this->freeBufferEventId);
+  
+  // Create epicsEvents for starting the live grab task and for signaling
+  // the acquisition task when a new live image is available
+  this->startGrabEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->startGrabEventId) {
+    printf("%s:%s epicsEventCreate failure for start grab event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  this->liveFrameEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->liveFrameEventId) {
+    printf("%s:%s epicsEventCreate failure for live frame event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  // Create an epicsEvent for starting a readout when the scheduler allows it
+  this->readoutSlot.pCamera = this;
+  this->readoutSlot.goEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->readoutSlot.goEventId) {
+    printf("%s:%s epicsEventCreate failure for readout slot event\n",
+           driverName, functionName);
+    return;
+  }
+  this->readoutRate = 0.0;
+  
+  // Create an epicsEvent for waking up the connection supervisor
+  this->supervisorEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->supervisorEventId) {
+    printf("%s:%s epicsEventCreate failure for supervisor event\n",
+           driverName, functionName);
+    return;
+  }
+  this->pollEventId = epicsEventCreate(epicsEventEmpty);
+  this->pollDoneEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->pollEventId || !this->pollDoneEventId) {
+    printf("%s:%s epicsEventCreate failure for link poll events\n",
+           driverName, functionName);
+    return;
+  }
+  this->pollBusy = 0;
+  this->captureEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->captureEventId) {
+    printf("%s:%s epicsEventCreate failure for capture event\n",
+           driverName, functionName);
+    return;
+  }
+  this->captureBusy = 0;
+  this->captureFunction = 0;
+  this->compressCodec = COMPRESS_NONE;
+  this->compressSubmitSeq = 0;
+  this->compressPublishSeq = 0;
+  this->compressPublishing = 0;
+  memset(this->compressRing, 0, sizeof(this->compressRing));
+  this->compressBytesIn = 0.0;
+  this->compressBytesOut = 0.0;
+  this->compressSeconds = 0.0;
+  epicsTimeGetCurrent(&(this->compressStatsTime));
+  this->compressMutex = epicsMutexCreate();
+  // Create an epicsEvent that the compression pool signals when it publishes
+  this->compressSpaceEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->compressSpaceEventId) {
+    printf("%s:%s epicsEventCreate failure for compression event\n",
+           driverName, functionName);
+    return;
+  }
+  this->cameraConnected = 0;
+  this->connecting = 0;
+  setIntegerParam(PhotronConnectState, CONNECT_STATE_DISCONNECTED);
+  this->linkLost = 0;
+  this->restorePending = 0;
+  this->reconnectDelay = RECONNECT_MIN_DELAY;
+  this->savedConfig.valid = 0;
+  
+  // Create an epicsEvent that the connect task signals when it is done
+  this->connectEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->connectEventId) {
+    printf("%s:%s epicsEventCreate failure for connect event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  // Create an epicsEvent for starting a preview prefetch pass
+  this->prefetchEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->prefetchEventId) {
+    printf("%s:%s epicsEventCreate failure for prefetch event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  // Create an epicsEvent for the end of a prefetch transfer
+  this->prefetchIdleEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->prefetchIdleEventId) {
+    printf("%s:%s epicsEventCreate failure for prefetch idle event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  // Create an epicsEvent for the end of a live transfer
+  this->grabIdleEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->grabIdleEventId) {
+    printf("%s:%s epicsEventCreate failure for grab idle event\n",
+           driverName, functionName);
+    return;
+  }
+  
+  // Create an epicsEvent for the end of a group arming status poll
+  this->armIdleEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->armIdleEventId) {
+    printf("%s:%s epicsEventCreate failure for arm idle event\n",
+           driverName, functionName);
+    return;
+  }
+  
   /* Register the shutdown function for epicsAtExit */
   epicsAtExit(shutdown, (void*)this);
 
@@ -302,21 +1208,131 @@ Photron::Photron(const char *portName, const char *ipAddress, int autoDetect,
     return;
   }
   
+  /* Create the thread that grabs live images */
+  status = (epicsThreadCreate("PhotronGrabTask", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackMedium),
+                (EPICSTHREADFUNC)PhotronGrabTaskC, this) == NULL);
+  if (status) {
+    printf("%s:%s epicsThreadCreate failure for grab task\n",
+           driverName, functionName);
+    return;
+  }
+  
+  /* Create the thread that prefetches preview frames */
+  status = (epicsThreadCreate("PhotronPrefetchTask", epicsThreadPriorityLow,
+                epicsThreadGetStackSize(epicsThreadStackMedium),
+                (EPICSTHREADFUNC)PhotronPrefetchTaskC, this) == NULL);
+  if (status) {
+    printf("%s:%s epicsThreadCreate failure for prefetch task\n",
+           driverName, functionName);
+    return;
+  }
+  
+  /* Create the thread that watches the link and reconnects to the camera. It
+   * starts supervising once the connect task is done. */
+  status = (epicsThreadCreate("PhotronSupervisorTask", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackMedium),
+                (EPICSTHREADFUNC)PhotronSupervisorTaskC, this) == NULL);
+  if (status) {
+    printf("%s:%s epicsThreadCreate failure for supervisor task\n",
+           driverName, functionName);
+    return;
+  }
+  
+  /* Create the thread that polls the camera status for the supervisor */
+  status = (epicsThreadCreate("PhotronPollTask", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackSmall),
+                (EPICSTHREADFUNC)PhotronPollTaskC, this) == NULL);
+  if (status) {
+    printf("%s:%s epicsThreadCreate failure for poll task\n",
+           driverName, functionName);
+    return;
+  }
+  
+  /* Create the thread that captures the references of the frame correction */
+  status = (epicsThreadCreate("PhotronCaptureTask", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackMedium),
+                (EPICSTHREADFUNC)PhotronCaptureTaskC, this) == NULL);
+  if (status) {
+    printf("%s:%s epicsThreadCreate failure for capture task\n",
+           driverName, functionName);
+    return;
+  }
+  
+  /* The connect task is started by photronInitHook once the IOC has been
+   * configured */
+  pNode->startConnect = 1;
+}
+
+
+/** Starts the connect task of every camera when iocInit begins, so that the 
+  * cameras of an IOC connect in parallel and iocInit can proceed while they 
+  * come up. The tasks aren't started by the constructor, so that they don't 
+  * run before the rest of the startup script has configured the IOC. */
+static void photronInitHook(initHookState state) {
+  cameraNode *pNode;
+  
+  if ((state != initHookAtIocBuild) || !cameraList) {
+    return;
+  }
+  pNode = (cameraNode *)ellFirst(cameraList);
+  while (pNode) {
+    if (pNode->startConnect) {
+      pNode->startConnect = 0;
+      if (epicsThreadCreate("PhotronConnectTask", epicsThreadPriorityMedium,
+                            epicsThreadGetStackSize(epicsThreadStackMedium),
+                            (EPICSTHREADFUNC)PhotronConnectTaskC, 
+                            pNode->pCamera) == NULL) {
+        printf("%s:photronInitHook epicsThreadCreate failure for connect task\n",
+               driverName);
+      }
+    }
+    pNode = (cameraNode *)ellNext(&pNode->node);
+  }
+}
+
+
+static void PhotronConnectTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronConnectTask();
+}
+
+/** This thread connects to the camera when the IOC starts. The lock isn't
+  * held while the camera is detected and opened, so neither the constructor
+  * nor iocInit wait for the camera. Until the camera is connected, asyn 
+  * rejects the requests for this port; ConnectState and the asyn connection
+  * state tell the clients when it is. */
+void Photron::PhotronConnectTask() {
+  int status;
+  epicsTimeStamp startTime, endTime;
+  const char *functionName = "PhotronConnectTask";
+  
+  this->lock();
+  
   /* Try to connect to the camera.  
    * It is not a fatal error if we cannot now, the camera may be off or owned by
    * someone else. It may connect later. */
-  this->lock();
+  epicsTimeGetCurrent(&startTime);
   status = connectCamera();
-  this->unlock();
+  epicsTimeGetCurrent(&endTime);
+  setDoubleParam(PhotronConnectTime, epicsTimeDiffInSeconds(&endTime, &startTime));
+  
   if (status) {
     printf("%s:%s: cannot connect to camera %s, manually connect later\n", 
            driverName, functionName, cameraId);
-    return;
+  } else {
+    printf("%s:%s: connected to camera %s in %.3f s\n", driverName, 
+           functionName, cameraId, epicsTimeDiffInSeconds(&endTime, &startTime));
+    // Does this need to be called before readParameters reads the trigger mode?
+    createStaticEnums();
+    createDynamicEnums();
   }
   
-  // Does this need to be called before readParameters reads the trigger mode?
-  createStaticEnums();
-  createDynamicEnums();
+  callParamCallbacks();
+  this->unlock();
+  
+  // Let the supervisor start
+  epicsEventSignal(this->connectEventId);
 }
 
 
@@ -328,9 +1344,20 @@ Photron::~Photron() {
   this->stopRecFlag = 1;
   epicsEventSignal(this->stopRecEventId);
   
+  // Frames in the compression pool still refer to this camera
+  flushCompression(5.0);
+  
   this->lock();
   printf("Disconnecting camera %s\n", this->portName);
   disconnectCamera();
+  releaseFrameData();
+  previewCacheClear();
+  clearCorrectionRefs(0);
+  epicsMutexLock(this->colorMutex);
+  free(this->colorScratch);
+  this->colorScratch = NULL;
+  this->colorScratchSize = 0;
+  epicsMutexUnlock(this->colorMutex);
   this->unlock();
 
   // Find this camera in the list:
@@ -364,6 +1391,126 @@ void Photron::timeDataToSec(PPDC_IRIG_INFO tData, double *seconds) {
 }
 
 
+/** Converts IRIG time data to an EPICS time stamp using the IRIG clock model.
+  * This is the only conversion from IRIG time to EPICS time; all readout 
+  * paths use it. */
+void Photron::timeDataToTimeStamp(PPDC_IRIG_INFO tData, epicsTimeStamp *pTimeStamp) {
+  double irigSeconds;
+  
+  timeDataToSec(tData, &irigSeconds);
+  *pTimeStamp = this->irigRefHost;
+  epicsTimeAddSeconds(pTimeStamp, this->irigOffset + 
+                      (irigSeconds - this->irigRefSec) * this->irigSlope);
+}
+
+
+/** Resets the IRIG clock model. Until samples are added, the camera's clock 
+  * is assumed to have started when IRIG was enabled and to run at the same
+  * rate as the host clock. */
+void Photron::resetIRIGModel() {
+  this->irigRefHost = this->postIRIGStartTime;
+  this->irigRefSec = 0.0;
+  this->irigOffset = 0.0;
+  this->irigSlope = 1.0;
+  this->irigNumSamples = 0;
+  this->irigNextSample = 0;
+  this->irigLastSampleTime = this->postIRIGStartTime;
+  setDoubleParam(PhotronIRIGResidual, 0.0);
+  setDoubleParam(PhotronIRIGDrift, 0.0);
+}
+
+
+/** Adds an (IRIG, host) sample to the IRIG clock model and refits it. 
+  * \param[in] tData The IRIG time read from the camera
+  * \param[in] pBefore The host time before the IRIG time was read
+  * \param[in] pAfter The host time after the IRIG time was read
+  */
+void Photron::addIRIGSample(PPDC_IRIG_INFO tData, epicsTimeStamp *pBefore, 
+                            epicsTimeStamp *pAfter) {
+  epicsTimeStamp host;
+  double irigSeconds, hostSeconds, predicted;
+  
+  timeDataToSec(tData, &irigSeconds);
+  
+  // The IRIG time was read at some point between before and after
+  host = *pBefore;
+  epicsTimeAddSeconds(&host, 0.5 * epicsTimeDiffInSeconds(pAfter, pBefore));
+  
+  if (this->irigNumSamples > 0) {
+    predicted = this->irigOffset + (irigSeconds - this->irigRefSec) * this->irigSlope;
+    hostSeconds = epicsTimeDiffInSeconds(&host, &(this->irigRefHost));
+    if (fabs(hostSeconds - predicted) > IRIG_MAX_ERROR) {
+      printf("IRIG clock jumped by %f seconds; restarting the clock model\n",
+             hostSeconds - predicted);
+      this->irigNumSamples = 0;
+      this->irigNextSample = 0;
+    }
+  }
+  
+  if (this->irigNumSamples == 0) {
+    // The first sample is the reference for the ones that follow
+    this->irigRefHost = host;
+    this->irigRefSec = irigSeconds;
+  }
+  
+  this->irigSampleX[this->irigNextSample] = irigSeconds - this->irigRefSec;
+  this->irigSampleY[this->irigNextSample] = epicsTimeDiffInSeconds(&host, &(this->irigRefHost));
+  this->irigNextSample = (this->irigNextSample + 1) % NUM_IRIG_SAMPLES;
+  if (this->irigNumSamples < NUM_IRIG_SAMPLES) {
+    this->irigNumSamples++;
+  }
+  this->irigLastSampleTime = *pAfter;
+  
+  fitIRIGModel();
+}
+
+
+/** Fits the offset and drift of the IRIG clock to the samples with a linear
+  * least-squares fit. The drift is only fitted once there are enough samples;
+  * until then the clocks are assumed to run at the same rate. */
+void Photron::fitIRIGModel() {
+  int index, n;
+  double meanX = 0.0, meanY = 0.0;
+  double sxx = 0.0, sxy = 0.0;
+  double dx, dy, residual = 0.0;
+  
+  n = this->irigNumSamples;
+  if (n == 0) {
+    return;
+  }
+  
+  for (index=0; index<n; index++) {
+    meanX += this->irigSampleX[index];
+    meanY += this->irigSampleY[index];
+  }
+  meanX /= n;
+  meanY /= n;
+  
+  for (index=0; index<n; index++) {
+    dx = this->irigSampleX[index] - meanX;
+    dy = this->irigSampleY[index] - meanY;
+    sxx += dx * dx;
+    sxy += dx * dy;
+  }
+  
+  if ((n >= IRIG_MIN_FIT_SAMPLES) && (sxx > 0.0)) {
+    this->irigSlope = sxy / sxx;
+  } else {
+    this->irigSlope = 1.0;
+  }
+  this->irigOffset = meanY - this->irigSlope * meanX;
+  
+  for (index=0; index<n; index++) {
+    dy = this->irigSampleY[index] - (this->irigOffset + this->irigSlope * this->irigSampleX[index]);
+    residual += dy * dy;
+  }
+  residual = sqrt(residual / n);
+  
+  setDoubleParam(PhotronIRIGResidual, residual);
+  setDoubleParam(PhotronIRIGDrift, (this->irigSlope - 1.0) * 1.0e6);
+}
+
+
 static void PhotronPlayTaskC(void *drvPvt) {
   Photron *pPvt = (Photron *)drvPvt;
   pPvt->PhotronPlayTask();
@@ -376,9 +1523,9 @@ void Photron::PhotronPlayTask() {
   //unsigned long status;
   unsigned long nRet;
   unsigned long nErrorCode;
-  epicsInt32 phostat, start, end, repeat, current;
-  epicsInt32 fps, multiplier;
+  epicsInt32 phostat, current;
   int index, nextIndex, stop;
+  int pending, cacheFrame;
   //
   int transferBitDepth;
   PDC_IRIG_INFO tData;
@@ -397,10 +1544,13 @@ void Photron::PhotronPlayTask() {
   int imageCounter;
   int numImagesCounter;
   int arrayCallbacks;
-  double updatePeriod, delay;
-  double elapsedTime;
-  double tRel, tStart, tNow;
-  epicsTimeStamp startTime, endTime;
+  double delay, behind;
+  double rateElapsed;
+  int skip, skipped;
+  long step;
+  int rateCount;
+  epicsTimeStamp irigTime, frameTime;
+  epicsTimeStamp anchorTime, now, rateTime;
   //
   const char *functionName = "PhotronPlayTask";
   
@@ -422,8 +1572,8 @@ void Photron::PhotronPlayTask() {
     
     // Only play images if we're in playback mode
     if (phostat == 1) {
-      getIntegerParam(PhotronPMStart, &start);
-      getIntegerParam(PhotronPMEnd, &end);
+      buildPlaySchedule();
+      this->playDir = (this->dirFlag == 1) ? 1 : -1;
       getIntegerParam(PhotronPMIndex, &current);
       
       if (this->pixelBits == 8) {
@@ -442,46 +1592,87 @@ void Photron::PhotronPlayTask() {
       //
       transferBitDepth = 8 * pixelSize;
       dataSize = this->memWidth * this->memHeight * pixelSize;
-      pBuf = malloc(dataSize);
+      // The SDK transfers frames into this buffer
+      pBuf = photronFrameMalloc(dataSize);
+      
+      // Keep the prefetch task off the camera while frames are being 
+      // transferred asynchronously
+      this->playActive = 1;
+      waitForPrefetch();
       
       // Start with the current start frame. If we're at the end, restart from
       // the beginning.
-      if ((this->dirFlag == 1) && (current == end)) {
-        index = start;
-      } else if ((this->dirFlag) == 0 && (current == start)) {
-        index = end;
+      if ((this->playDir > 0) && (current == this->playEnd)) {
+        index = this->playStart;
+      } else if ((this->playDir < 0) && (current == this->playStart)) {
+        index = this->playEnd;
       } else {
         index = current;
       }
       
-      // Preload the first frame
-      nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, index,
-                                      transferBitDepth, pBuf, &nErrorCode);
-      if (nRet == PDC_FAILED) {
-        printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, index);
+      memset(&tData, 0, sizeof(tData));
+      
+      // Preload the first frame unless it is cached
+      pending = 0;
+      if (!previewCacheFind(index, dataSize)) {
+        nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, index,
+                                        transferBitDepth, pBuf, &nErrorCode);
+        if (nRet == PDC_FAILED) {
+          printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, index);
+        }
+        pending = 1;
+        this->previewCacheMisses++;
       }
       
-      epicsTimeGetCurrent(&startTime);
+      // The playback schedule is anchored when the first frame is requested
+      epicsTimeGetCurrent(&anchorTime);
+      step = 0;
+      skipped = 0;
+      rateCount = 0;
+      epicsTimeGetCurrent(&rateTime);
+      setIntegerParam(PhotronPMSkipped, 0);
+      setDoubleParam(PhotronPMAchievedFPS, 0.0);
       
       while (1) {
-        // Acquire the image data
-        nRet = PDC_GetMemImageDataEnd(this->nDeviceNo, this->nChildNo,
-                                        transferBitDepth, pBuf, &nErrorCode);
-        if (nRet == PDC_FAILED) {
-          printf("PDC_GetMemImageDataEnd Error %d\n", nErrorCode);
+        // Use the cached frame, or fetch it now if it was evicted while unlocked
+        if (!pending && !previewCacheGet(index, pBuf, dataSize, &tData)) {
+          nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, index,
+                                          transferBitDepth, pBuf, &nErrorCode);
+          if (nRet == PDC_FAILED) {
+            printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, index);
+          }
+          pending = 1;
         }
         
-        setIntegerParam(PhotronPMIndex, index);
-        
-        // Retrieve frame time
-        if (this->tMode == 1) {
-          //
-          nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, index,
-                                    &tData, &nErrorCode);
+        if (pending) {
+          // Acquire the image data
+          cacheFrame = 1;
+          nRet = PDC_GetMemImageDataEnd(this->nDeviceNo, this->nChildNo,
+                                          transferBitDepth, pBuf, &nErrorCode);
           if (nRet == PDC_FAILED) {
-            printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+            printf("PDC_GetMemImageDataEnd Error %d\n", nErrorCode);
+            cacheFrame = 0;
           }
           
+          // Retrieve frame time
+          if (this->tMode == 1) {
+            nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, index,
+                                      &tData, &nErrorCode);
+            if (nRet == PDC_FAILED) {
+              printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+              cacheFrame = 0;
+            }
+          }
+          
+          if (cacheFrame) {
+            previewCachePut(index, pBuf, dataSize, &tData);
+          }
+        }
+        updatePreviewCacheParams();
+        
+        setIntegerParam(PhotronPMIndex, index);
+        
+        if (this->tMode == 1) {
           setIntegerParam(PhotronMemIRIGDay, tData.m_nDayOfYear);
           setIntegerParam(PhotronMemIRIGHour, tData.m_nHour);
           setIntegerParam(PhotronMemIRIGMin, tData.m_nMinute);
@@ -500,75 +1691,62 @@ void Photron::PhotronPlayTask() {
           this->pArrays[0]->release();
   
         /* Allocate the raw buffer */
+        this->pArrays[0] = NULL;
         pImage = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
         if (!pImage) {
           asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                     "%s:%s: error allocating buffer\n", driverName, functionName);
+        } else {
+          memcpy(pImage->pData, pBuf, dataSize);
+          pImage = convertColor(pImage, &colorMode, NULL);
+        }
+        if (!pImage) {
+          // The frame is dropped and counted as skipped
+          skipped++;
+          setIntegerParam(PhotronPMSkipped, skipped);
         }
         
-        //
-        memcpy(pImage->pData, pBuf, dataSize);
+        // Pick up changes to the playback parameters. Step k of the playback
+        // is due at anchorTime + k / fps, so the schedule restarts from this
+        // frame when it is rebuilt.
+        epicsTimeGetCurrent(&now);
+        if (this->playScheduleChanged) {
+          buildPlaySchedule();
+          anchorTime = now;
+          step = 0;
+        }
+        step++;
         
-        // Allow repeat and multiplier to be changed during playback
-        getIntegerParam(PhotronPMRepeat, &repeat);
-        getIntegerParam(PhotronPMPlayMult, &multiplier);
+        // If the next step is already overdue, skip the steps that should
+        // have been shown by now to hold real-time pace
+        behind = epicsTimeDiffInSeconds(&now, &anchorTime) * this->playFps - step;
+        skip = (behind >= 1.0) ? (int)behind : 0;
+        step += skip;
         
-        // Determine if another frame should start preloading based on index
-        if (this->dirFlag == 1) {
-          // forward direction
-          if (index == end) {
-            if (repeat == 1) {
-              printf("It is time to REPEAT\n");
-              printf("\tindex=%d, start=%d, end=%d\n", index, start, end);
-              nextIndex = start;
-              stop = 0;
-            } else {
-              nextIndex = end;
-              stop = 1;
-            }
-          } else {
-            nextIndex = index + multiplier;
-            if (nextIndex > end) {
-              nextIndex = end;
-            }
-            stop = 0;
-          }
-        } else {
-          // reverse direction
-          if (index == start) {
-            if (repeat == 1) {
-              printf("It is time to REPEAT\n");
-              printf("\tindex=%d, start=%d, end=%d\n", index, start, end);
-              nextIndex = end;
-              stop = 0;
-            } else {
-              nextIndex = start;
-              stop = 1;
-            }
-          } else {
-            nextIndex = index - multiplier;
-            if (nextIndex < start) {
-              nextIndex = start;
-            }
-            stop = 0;
-          }
-        }
+        stop = advancePlaySchedule(index, 1 + skip, &nextIndex);
         
-        // Allow the speed to be changed during playback
-        getIntegerParam(PhotronPMPlayFPS, &fps);
-        updatePeriod = 1.0 / fps;
+        if ((skip > 0) && (stop == 0)) {
+          skipped += skip * this->playStride;
+          setIntegerParam(PhotronPMSkipped, skipped);
+        }
         
-        // delay if possible and necessary
-        epicsTimeGetCurrent(&endTime);
-        elapsedTime = epicsTimeDiffInSeconds(&endTime, &startTime);
-        delay = updatePeriod - elapsedTime;
+        // Wait for the deadline of the next step
+        delay = (double)step / this->playFps - epicsTimeDiffInSeconds(&now, &anchorTime);
         if (delay > 0) {
-          //printf("delay = %f\n", delay);
           this->unlock();
           epicsEventWaitWithTimeout(this->stopPlayEventId, delay);
           this->lock();
         }
-        epicsTimeGetCurrent(&startTime);
+        
+        // Update the achieved frame rate about once a second
+        rateCount++;
+        epicsTimeGetCurrent(&now);
+        rateElapsed = epicsTimeDiffInSeconds(&now, &rateTime);
+        if (rateElapsed >= 1.0) {
+          setDoubleParam(PhotronPMAchievedFPS, rateCount / rateElapsed);
+          rateCount = 0;
+          rateTime = now;
+        }
         
         // Check to see if the user requested playback to stop
         if (this->stopFlag == 1) {
@@ -577,68 +1755,74 @@ void Photron::PhotronPlayTask() {
         
         //
         if (stop == 0) {
-          // Start preloading the next frame
-          nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, nextIndex,
-                                          transferBitDepth, pBuf, &nErrorCode);
-          if (nRet == PDC_FAILED) {
-            printf("PDC_GetMemImageDataStart Error %d; nextIndex = %d\n", nErrorCode, nextIndex);
+          // Start preloading the next frame unless it is cached
+          if (previewCacheFind(nextIndex, dataSize)) {
+            pending = 0;
+          } else {
+            nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, nextIndex,
+                                            transferBitDepth, pBuf, &nErrorCode);
+            if (nRet == PDC_FAILED) {
+              printf("PDC_GetMemImageDataStart Error %d; nextIndex = %d\n", nErrorCode, nextIndex);
+            }
+            pending = 1;
+            this->previewCacheMisses++;
           }
         } else {
           printf("Stopping after posting this last image to plugins\n");
         }
         
-        this->pArrays[0] = pImage;
-        pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
-                                    &colorMode);
-        pImage->getInfo(&arrayInfo);
-        setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
-        setIntegerParam(NDArraySizeX, (int)pImage->dims[0].size);
-        setIntegerParam(NDArraySizeY, (int)pImage->dims[1].size);
+        if (pImage) {
+          this->pArrays[0] = pImage;
+          pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
+                                      &colorMode);
+          addFrameAttributes(pImage, index);
+          pImage->getInfo(&arrayInfo);
+          setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
+          setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+          setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
         
-        /* Call the callbacks to update any changes */
-        callParamCallbacks();
+          /* Call the callbacks to update any changes */
+          callParamCallbacks();
         
-         // Get params
-        getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+           // Get params
+          getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
         
-        // Set the image counters during playback to the values they would have
-        // if the frames were saved with the current settings
-        imageCounter = this->NDArrayCounterBackup + index - start;
-        setIntegerParam(NDArrayCounter, imageCounter);
-        numImagesCounter = index - start;
-        setIntegerParam(ADNumImagesCounter, numImagesCounter);
+          // Set the image counters during playback to the values they would have
+          // if the frames were saved with the current settings
+          imageCounter = this->NDArrayCounterBackup + index - this->playStart;
+          setIntegerParam(NDArrayCounter, imageCounter);
+          numImagesCounter = index - this->playStart;
+          setIntegerParam(ADNumImagesCounter, numImagesCounter);
         
-        /* Put the frame number and time stamp into the buffer */
-        pImage->uniqueId = imageCounter;
-        if (tMode == 1) {
-          // Absolute time
-          //irigSeconds = (((((tData.m_nDayOfYear * 24) + tData.m_nHour) * 60) + tData.m_nMinute) * 60) + tData.m_nSecond;
-          //pImage->timeStamp = (this->postIRIGStartTime).secPastEpoch + irigSeconds + (this->postIRIGStartTime).nsec / 1.e9 + tData.m_nMicroSecond / 1.e6;
-          // Relative time
-          this->timeDataToSec(&tData, &tNow);
-          this->timeDataToSec(&(this->tDataStart), &tStart);
-          tRel = tNow - tStart;
-          pImage->timeStamp = tRel;
-        }
-        else {
-          // Use theoretical time
-          pImage->timeStamp = 1.0 * index / this->memRate;
-        }
-        updateTimeStamp(&pImage->epicsTS);
+          /* Put the frame number and time stamp into the buffer */
+          pImage->uniqueId = imageCounter;
+          if (tMode == 1) {
+            // Absolute time from the IRIG clock model
+            this->timeDataToTimeStamp(&tData, &irigTime);
+            pImage->timeStamp = irigTime.secPastEpoch + irigTime.nsec / 1.e9;
+            pImage->epicsTS = irigTime;
+          }
+          else {
+            // Time from the frame time model
+            this->frameTimeToTimeStamp(index, &frameTime);
+            pImage->timeStamp = frameTime.secPastEpoch + frameTime.nsec / 1.e9;
+            pImage->epicsTS = frameTime;
+          }
         
-        /* Get any attributes that have been defined for this driver */
-        this->getAttributes(pImage->pAttributeList);
+          /* Get any attributes that have been defined for this driver */
+          this->getAttributes(pImage->pAttributeList);
         
-        if (arrayCallbacks) {
-          /* Call the NDArray callback */
-          /* Must release the lock here, or we can get into a deadlock, because we
-          * can block on the plugin lock, and the plugin can be calling us */
-          this->unlock();
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-                    "%s:%s: calling imageData callback\n", driverName,
-                    functionName);
-          doCallbacksGenericPointer(pImage, NDArrayData, 0);
-          this->lock();
+          if (arrayCallbacks) {
+            /* Call the NDArray callback */
+            /* Must release the lock here, or we can get into a deadlock, because we
+            * can block on the plugin lock, and the plugin can be calling us */
+            this->unlock();
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                      "%s:%s: calling imageData callback\n", driverName,
+                      functionName);
+            doCallbacksGenericPointer(pImage, NDArrayData, 0);
+            this->lock();
+          }
         }
         
         if (stop == 1) {
@@ -649,7 +1833,11 @@ void Photron::PhotronPlayTask() {
         }
       }
       
-      free(pBuf);
+      photronFrameFree(pBuf);
+      
+      // Prefetch around the frame where playback stopped
+      this->playActive = 0;
+      requestPrefetch(index);
       
     } else {
       printf("Play was request but camera isn't in playback mode!\n");
@@ -692,6 +1880,7 @@ void Photron::PhotronWaitTask() {
       nRet = PDC_GetStatus(this->nDeviceNo, &status, &nErrorCode);
       if (nRet == PDC_FAILED) {
         printf("PDC_GetStatus (#1) failed %d\n", nErrorCode);
+        checkLinkError(nErrorCode);
       }
       setIntegerParam(PhotronStatus, status);
       eStatus = statusToEPICS(status);
@@ -734,6 +1923,7 @@ void Photron::PhotronRecTask() {
   int acqMode, previewMode;
   int eStatus;
   
+  int pmIndex;
   const char *functionName = "PhotronRecTask";
 
   
@@ -761,6 +1951,7 @@ void Photron::PhotronRecTask() {
       
       // Reset the stopRecFlag
       this->stopRecFlag = 0;
+      this->recStartValid = 0;
     }
     
     // Wait for triggered recording
@@ -769,10 +1960,17 @@ void Photron::PhotronRecTask() {
       nRet = PDC_GetStatus(this->nDeviceNo, &status, &nErrorCode);
       if (nRet == PDC_FAILED) {
         printf("PDC_GetStatus (#2) failed %d\n", nErrorCode);
+        checkLinkError(nErrorCode);
       }
       setIntegerParam(PhotronStatus, status);
       if (status == PDC_STATUS_REC) {
         setIntegerParam(ADStatus, ADStatusAcquire);
+        // Remember when the recording was first seen; this is close to the 
+        // time of the trigger
+        if (!this->recStartValid) {
+          epicsTimeGetCurrent(&(this->recStartTime));
+          this->recStartValid = 1;
+        }
       } else if ((status == PDC_STATUS_ENDLESS) || (status == PDC_STATUS_RECREADY)) {
         setIntegerParam(ADStatus, ADStatusWaiting);
         // Reset the acquire button -- THIS HAPPENS TOO SOON. The status hasn't changed to record yet
@@ -784,6 +1982,7 @@ void Photron::PhotronRecTask() {
       
       // Triggered acquisition is done when camera status returns to live
       if (status == PDC_STATUS_LIVE) {
+        epicsTimeGetCurrent(&(this->recEndTime));
         //
         printf("!!!\tAcquisition is done\n");
         //epicsThreadSleep(1.0);
@@ -795,6 +1994,13 @@ void Photron::PhotronRecTask() {
         // readMem should set the readout params to the max?
         readMem();
         
+        // Anchor the frame times of the recording
+        setFrameTimeAnchor();
+        
+        // Fill the pool with buffers that match the recording, so that 
+        // allocation doesn't happen while frames are being read out
+        reserveReadoutBuffers();
+        
         getIntegerParam(PhotronPreviewMode, &previewMode);
         
         // Optionally enter preview mode here
@@ -803,6 +2009,8 @@ void Photron::PhotronRecTask() {
           
           // Signal that previewing is in progress
           this->previewDone = 0;
+          getIntegerParam(PhotronPMIndex, &pmIndex);
+          requestPrefetch(pmIndex);
           
           // Wait until user is done previewing the data
           this->unlock();
@@ -811,6 +2019,7 @@ void Photron::PhotronRecTask() {
         
           // Signal that previewing is done
           this->previewDone = 1;
+          waitForPrefetch();
         }
         
         // Re-zero the num images complete (num will = total saved this acq)
@@ -819,8 +2028,19 @@ void Photron::PhotronRecTask() {
         setIntegerParam(NDArrayCounter, this->NDArrayCounterBackup);
         callParamCallbacks();
         
-        // Read specified image range here
-        this->readImageRange();
+        // Read specified image range here, when the readout scheduler 
+        // allows it
+        if (acquireReadoutSlot() == asynSuccess) {
+          this->readImageRange();
+          releaseReadoutSlot();
+        }
+        
+        // Return the reserved buffers
+        releaseReadoutBuffers();
+        
+        // The record start time only applies to the recording that was read
+        // out. A user-supplied TrigTime is kept until the user changes it.
+        this->recStartValid = 0;
         
         // Reset Acquire
         setIntegerParam(ADAcquire, 0);
@@ -854,7 +2074,9 @@ static void PhotronTaskC(void *drvPvt) {
 
 /** This thread calls readImage to retrieve new image data from the camera and 
   * does the callbacks to send it to higher layers. It implements the logic for 
-  * single, multiple or continuous acquisition. */
+  * single, multiple or continuous acquisition. When the live grabber is 
+  * enabled, images are retrieved by PhotronGrabTask and this thread publishes 
+  * the newest one every acquire period. */
 void Photron::PhotronTask() {
   asynStatus imageStatus;
   int imageCounter;
@@ -862,6 +2084,7 @@ void Photron::PhotronTask() {
   int imageMode;
   int arrayCallbacks;
   int acquire;
+  int grabber;
   NDArray *pImage;
   double acquirePeriod, delay;
   epicsTimeStamp startTime, endTime;
@@ -897,6 +2120,7 @@ void Photron::PhotronTask() {
 
     /* Get the exposure parameters */
     getDoubleParam(ADAcquirePeriod, &acquirePeriod);
+    getIntegerParam(PhotronLiveGrabber, &grabber);
 
     setIntegerParam(ADStatus, ADStatusAcquire);
 
@@ -909,7 +2133,11 @@ void Photron::PhotronTask() {
     //printf("I should do something\n");
     
     /* Read the image */
-    imageStatus = readImage();
+    if (grabber) {
+      imageStatus = readLatestImage();
+    } else {
+      imageStatus = readImage();
+    }
 
     /* Close the shutter */
     //setShutter(ADShutterClosed);
@@ -931,10 +2159,9 @@ void Photron::PhotronTask() {
       setIntegerParam(NDArrayCounter, imageCounter);
       setIntegerParam(ADNumImagesCounter, numImagesCounter);
 
-      /* Put the frame number and time stamp into the buffer */
+      /* Put the frame number into the buffer. Live images are time stamped
+       * when they are read */
       pImage->uniqueId = imageCounter;
-      pImage->timeStamp = startTime.secPastEpoch + startTime.nsec / 1.e9;
-      updateTimeStamp(&pImage->epicsTS);
 
       /* Get any attributes that have been defined for this driver */
       this->getAttributes(pImage->pAttributeList);
@@ -947,7 +2174,7 @@ void Photron::PhotronTask() {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
                   "%s:%s: calling imageData callback\n", driverName,
                   functionName);
-        doCallbacksGenericPointer(pImage, NDArrayData, 0);
+        publishArray(pImage, 0);
         this->lock();
       }
     }
@@ -984,6 +2211,511 @@ void Photron::PhotronTask() {
 }
 
 
+static void PhotronPrefetchTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronPrefetchTask();
+}
+
+/** This thread reads the frames around the preview index into the preview 
+  * cache, PMPrefetchAhead frames in the direction the user is moving and 
+  * PMPrefetchBehind frames in the other direction, nearest first. Frames are
+  * transferred without the lock, and a pass stops as soon as the user moves 
+  * to another frame, starts playback or leaves preview mode. A frame whose
+  * pass was cancelled during the transfer isn't cached. */
+void Photron::PhotronPrefetchTask() {
+  unsigned long nRet;
+  unsigned long nErrorCode;
+  unsigned long generation;
+  long center, frameNo;
+  int dir, ahead, behind, start, end, budget;
+  int i, cacheFrame, irigMode;
+  int transferBitDepth, pixelSize;
+  size_t dataSize;
+  size_t bufSize = 0;
+  void *pBuf = NULL;
+  PDC_IRIG_INFO tData;
+  const char *functionName = "PhotronPrefetchTask";
+  
+  this->lock();
+  /* Loop forever */
+  while (1) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: waiting for a prefetch request\n", driverName, 
+              functionName);
+    this->unlock();
+    epicsEventWait(this->prefetchEventId);
+    this->lock();
+    
+    generation = this->prefetchGeneration;
+    center = this->prefetchIndex;
+    dir = this->prefetchDir;
+    getIntegerParam(PhotronPMPrefetchAhead, &ahead);
+    getIntegerParam(PhotronPMPrefetchBehind, &behind);
+    getIntegerParam(PhotronPMStart, &start);
+    getIntegerParam(PhotronPMEnd, &end);
+    getIntegerParam(PhotronPMCacheBudget, &budget);
+    
+    if (budget <= 0) {
+      continue;
+    }
+    
+    pixelSize = (this->pixelBits == 8) ? 1 : 2;
+    transferBitDepth = 8 * pixelSize;
+    dataSize = this->memWidth * this->memHeight * pixelSize;
+    if (dataSize != bufSize) {
+      photronFrameFree(pBuf);
+      pBuf = photronFrameMalloc(dataSize);
+      bufSize = pBuf ? dataSize : 0;
+    }
+    if (!pBuf) {
+      continue;
+    }
+    
+    for (i = 0; i < ahead + behind; i++) {
+      // Stop if the user moved on
+      if ((generation != this->prefetchGeneration) || this->previewDone || 
+          this->playActive) {
+        break;
+      }
+      
+      if (i < ahead) {
+        frameNo = dir ? (center + i + 1) : (center - i - 1);
+      } else {
+        frameNo = dir ? (center - (i - ahead) - 1) : (center + (i - ahead) + 1);
+      }
+      if ((frameNo < start) || (frameNo > end) || 
+          previewCacheFind(frameNo, dataSize)) {
+        continue;
+      }
+      
+      memset(&tData, 0, sizeof(tData));
+      cacheFrame = 1;
+      irigMode = this->tMode;
+      
+      // Transfer without the lock. Anything else that uses the camera's 
+      // memory cancels the pass and waits for prefetchIdleEventId first.
+      this->prefetchBusy = 1;
+      this->unlock();
+      nRet = PDC_GetMemImageData(this->nDeviceNo, this->nChildNo, frameNo,
+                                 transferBitDepth, pBuf, &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetMemImageData Error %d; frameNo = %ld\n", nErrorCode, frameNo);
+        cacheFrame = 0;
+      }
+      
+      if (cacheFrame && (irigMode == 1)) {
+        nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, frameNo,
+                                  &tData, &nErrorCode);
+        if (nRet == PDC_FAILED) {
+          printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+          cacheFrame = 0;
+        }
+      }
+      this->lock();
+      this->prefetchBusy = 0;
+      epicsEventSignal(this->prefetchIdleEventId);
+      
+      if (cacheFrame && (generation == this->prefetchGeneration) && 
+          !this->previewDone) {
+        previewCachePut(frameNo, pBuf, dataSize, &tData);
+        updatePreviewCacheParams();
+        callParamCallbacks();
+      }
+    }
+  }
+}
+
+
+static void PhotronGrabTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronGrabTask();
+}
+
+/** This thread continuously reads live images while live acquisition is 
+  * active and the live grabber is enabled. Only the newest image is kept; if
+  * PhotronTask hasn't published the previous image by the time a new one 
+  * arrives, the previous image is dropped. Together with the image being read
+  * and the image being published, this gives triple-buffered, latest-frame
+  * semantics, so slow plugins delay the display but don't make it stale. */
+void Photron::PhotronGrabTask() {
+  asynStatus imageStatus;
+  int acquire, acqMode, grabber;
+  int dropped;
+  int numGrabbed = 0;
+  NDArray *pImage;
+  epicsTimeStamp grabTime, rateTime;
+  double rateElapsed, pollPeriod;
+  const char *functionName = "PhotronGrabTask";
+  
+  epicsTimeGetCurrent(&rateTime);
+  
+  this->lock();
+  /* Loop forever */
+  while (1) {
+    getIntegerParam(ADAcquire, &acquire);
+    getIntegerParam(PhotronAcquireMode, &acqMode);
+    getIntegerParam(PhotronLiveGrabber, &grabber);
+    
+    if (!acquire || (acqMode != 0) || !grabber) {
+      /* Discard the image that wasn't published */
+      epicsMutexLock(this->liveMutex);
+      if (this->liveLatest) {
+        this->liveLatest->release();
+        this->liveLatest = NULL;
+      }
+      epicsMutexUnlock(this->liveMutex);
+      
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s:%s: waiting for acquire to start\n", driverName, 
+                functionName);
+      this->unlock();
+      epicsEventWait(this->startGrabEventId);
+      this->lock();
+      
+      setIntegerParam(PhotronLiveDropped, 0);
+      setDoubleParam(PhotronLiveGrabRate, 0.0);
+      callParamCallbacks();
+      numGrabbed = 0;
+      epicsTimeGetCurrent(&rateTime);
+      continue;
+    }
+    
+    imageStatus = grabLiveImage(&pImage, 1);
+    
+    if (imageStatus != asynSuccess) {
+      /* Stop acquisition, as PhotronTask does when readImage fails */
+      setIntegerParam(ADAcquire, 0);
+      callParamCallbacks();
+      epicsEventSignal(this->liveFrameEventId);
+      continue;
+    }
+    
+    if (!pImage) {
+      /* The camera hasn't produced a new frame yet. Wait about half a frame
+       * period; stopping the acquisition ends the wait. */
+      pollPeriod = (this->nRate > 0) ? (0.5 / this->nRate) : GRAB_POLL_MAX;
+      if (pollPeriod > GRAB_POLL_MAX) {
+        pollPeriod = GRAB_POLL_MAX;
+      }
+      this->unlock();
+      epicsEventWaitWithTimeout(this->startGrabEventId, pollPeriod);
+      this->lock();
+      continue;
+    }
+    
+    /* These release the lock during the transfer and the processing */
+    pImage = correctFrame(pImage, NULL);
+    pImage = convertColor(pImage, NULL, NULL);
+    if (!pImage) {
+      getIntegerParam(PhotronLiveDropped, &dropped);
+      setIntegerParam(PhotronLiveDropped, dropped + 1);
+      continue;
+    }
+    
+    /* Replace the newest image */
+    epicsMutexLock(this->liveMutex);
+    if (this->liveLatest) {
+      this->liveLatest->release();
+      getIntegerParam(PhotronLiveDropped, &dropped);
+      setIntegerParam(PhotronLiveDropped, dropped + 1);
+    }
+    this->liveLatest = pImage;
+    epicsMutexUnlock(this->liveMutex);
+    epicsEventSignal(this->liveFrameEventId);
+    
+    /* Update the grab rate about once a second */
+    numGrabbed++;
+    epicsTimeGetCurrent(&grabTime);
+    rateElapsed = epicsTimeDiffInSeconds(&grabTime, &rateTime);
+    if (rateElapsed >= 1.0) {
+      setDoubleParam(PhotronLiveGrabRate, numGrabbed / rateElapsed);
+      callParamCallbacks();
+      numGrabbed = 0;
+      rateTime = grabTime;
+    }
+  }
+}
+
+
+static void PhotronSupervisorTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronSupervisorTask();
+}
+
+/** This thread supervises the connection to the camera. It polls the camera
+  * status while the camera is idle and is woken up when a PDC call fails 
+  * with an error that means the link was lost. It then disconnects and 
+  * tries to reconnect with an exponential backoff. Once the camera is back, 
+  * the settings it had before the link was lost are restored. */
+void Photron::PhotronSupervisorTask() {
+  double delay;
+  int autoReconnect, reconnectCount;
+  epicsTimeStamp now;
+  const char *functionName = "PhotronSupervisorTask";
+  
+  // Wait for the connect task
+  epicsEventWait(this->connectEventId);
+  
+  this->lock();
+  // A camera that could not be connected at startup is down from now on
+  if (!this->cameraConnected) {
+    epicsTimeGetCurrent(&(this->linkLostTime));
+    this->restorePending = 1;
+  }
+  
+  /* Loop forever */
+  while (1) {
+    delay = this->cameraConnected ? SUPERVISOR_PERIOD : this->reconnectDelay;
+    this->unlock();
+    epicsEventWaitWithTimeout(this->supervisorEventId, delay);
+    this->lock();
+    
+    if (this->cameraConnected && !this->linkLost) {
+      pollLinkStatus();
+    }
+    
+    if (this->cameraConnected && this->linkLost) {
+      handleLinkLoss();
+    }
+    
+    if (!this->cameraConnected) {
+      epicsTimeGetCurrent(&now);
+      setDoubleParam(PhotronDowntime, 
+                     epicsTimeDiffInSeconds(&now, &(this->linkLostTime)));
+      getIntegerParam(PhotronAutoReconnect, &autoReconnect);
+      if (autoReconnect) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s:%s: reconnecting to camera %s\n", driverName, 
+                  functionName, this->cameraId);
+        if (connectCamera() == asynSuccess) {
+          this->reconnectDelay = RECONNECT_MIN_DELAY;
+        } else {
+          this->reconnectDelay *= 2.0;
+          if (this->reconnectDelay > RECONNECT_MAX_DELAY) {
+            this->reconnectDelay = RECONNECT_MAX_DELAY;
+          }
+        }
+      }
+    }
+    
+    // The camera may also have been connected through asynManager
+    if (this->cameraConnected && this->restorePending) {
+      this->restorePending = 0;
+      createStaticEnums();
+      createDynamicEnums();
+      restoreCameraConfig();
+      
+      epicsTimeGetCurrent(&now);
+      setDoubleParam(PhotronDowntime, 
+                     epicsTimeDiffInSeconds(&now, &(this->linkLostTime)));
+      getIntegerParam(PhotronReconnectCount, &reconnectCount);
+      setIntegerParam(PhotronReconnectCount, reconnectCount + 1);
+      setIntegerParam(ADStatus, ADStatusIdle);
+      printf("%s:%s: reconnected to camera %s\n", driverName, functionName, 
+             this->cameraId);
+    }
+    
+    callParamCallbacks();
+  }
+}
+
+
+/** Checks whether the error code of a failed PDC call means that the link to
+  * the camera was lost. If so, the supervisor is woken up to reconnect. */
+void Photron::checkLinkError(unsigned long nErrorCode) {
+  switch (nErrorCode) {
+    case PDC_ERROR_ILLEGAL_DEV_NO:
+    case PDC_ERROR_NO_DEVICE:
+    case PDC_ERROR_TIMEOUT:
+    case PDC_ERROR_NOTOPEN:
+    case PDC_ERROR_SEND_ERROR:
+    case PDC_ERROR_RECEIVE_ERROR:
+      if (this->cameraConnected && !this->linkLost) {
+        this->linkLost = 1;
+        epicsEventSignal(this->supervisorEventId);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+
+/** Polls the camera status to check the link. This is only done while the 
+  * camera is idle; otherwise the failures of the PDC calls that are being 
+  * made are checked instead. The status is read by PhotronPollTask without
+  * the lock, and the link is lost if it doesn't answer within 
+  * STATUS_POLL_TIMEOUT, even if the PDC call never returns. Called by the
+  * supervisor with the lock held. */
+void Photron::pollLinkStatus() {
+  int acquire, acqMode;
+  
+  getIntegerParam(ADAcquire, &acquire);
+  getIntegerParam(PhotronAcquireMode, &acqMode);
+  if (acquire || acqMode || !this->previewDone || this->playActive || 
+      this->forceWait) {
+    return;
+  }
+  
+  // A poll that timed out may still be stuck in the SDK
+  if (this->pollBusy) {
+    return;
+  }
+  
+  this->pollBusy = 1;
+  // Forget the completion of a poll that timed out
+  epicsEventTryWait(this->pollDoneEventId);
+  epicsEventSignal(this->pollEventId);
+  this->unlock();
+  epicsEventWaitWithTimeout(this->pollDoneEventId, STATUS_POLL_TIMEOUT);
+  this->lock();
+  
+  if (this->pollBusy) {
+    printf("PDC_GetStatus (#6) didn't return within %.1f s\n", 
+           STATUS_POLL_TIMEOUT);
+    this->linkLost = 1;
+  } else if (this->pollRet == PDC_FAILED) {
+    printf("PDC_GetStatus (#6) failed %d\n", this->pollErrorCode);
+    checkLinkError(this->pollErrorCode);
+  }
+}
+
+
+static void PhotronPollTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronPollTask();
+}
+
+/** This thread reads the camera status for pollLinkStatus, without the lock,
+  * so that the supervisor can give up on a call that doesn't return. */
+void Photron::PhotronPollTask() {
+  unsigned long nRet;
+  unsigned long nErrorCode = 0;
+  unsigned long status;
+  
+  while (1) {
+    epicsEventWait(this->pollEventId);
+    nRet = PDC_GetStatus(this->nDeviceNo, &status, &nErrorCode);
+    this->lock();
+    this->pollRet = nRet;
+    this->pollErrorCode = nErrorCode;
+    this->pollBusy = 0;
+    // Signalled with the lock held, so that a later poll can't see it
+    epicsEventSignal(this->pollDoneEventId);
+    this->unlock();
+  }
+}
+
+
+/** Stops everything that uses the camera after the link was lost, saves the 
+  * settings to restore and disconnects. disconnectCamera waits for the 
+  * threads that are in the SDK without the lock before closing the device. */
+void Photron::handleLinkLoss() {
+  static const char *functionName = "handleLinkLoss";
+  
+  printf("%s:%s: lost the link to camera %s\n", driverName, functionName,
+         this->cameraId);
+  
+  saveCameraConfig();
+  
+  // Stop live acquisition
+  setIntegerParam(ADAcquire, 0);
+  epicsEventSignal(this->stopEventId);
+  epicsEventSignal(this->liveFrameEventId);
+  // Leave record mode and abort any readout or preview
+  setIntegerParam(PhotronAcquireMode, 0);
+  this->stopRecFlag = 1;
+  epicsEventSignal(this->stopRecEventId);
+  this->abortFlag = 1;
+  epicsEventSignal(this->freeBufferEventId);
+  this->stopFlag = 1;
+  epicsEventSignal(this->stopPlayEventId);
+  
+  disconnectCamera();
+  this->linkLost = 0;
+  this->restorePending = 1;
+  this->reconnectDelay = RECONNECT_MIN_DELAY;
+  epicsTimeGetCurrent(&(this->linkLostTime));
+  setDoubleParam(PhotronDowntime, 0.0);
+  setIntegerParam(ADStatus, ADStatusError);
+}
+
+
+/** Saves the last-known camera settings from the parameter library, so that
+  * they can be restored when the camera reconnects. */
+void Photron::saveCameraConfig() {
+  cameraConfig *pConfig = &(this->savedConfig);
+  int port;
+  
+  getIntegerParam(PhotronCamMode, &(pConfig->camMode));
+  getIntegerParam(PhotronRecRate, &(pConfig->recRate));
+  getIntegerParam(ADSizeX, &(pConfig->sizeX));
+  getIntegerParam(ADSizeY, &(pConfig->sizeY));
+  getIntegerParam(ADTriggerMode, &(pConfig->triggerMode));
+  getIntegerParam(PhotronAfterFrames, &(pConfig->afterFrames));
+  getIntegerParam(PhotronRandomFrames, &(pConfig->randomFrames));
+  getIntegerParam(PhotronRecCount, &(pConfig->recCount));
+  for (port=0; port<PDC_EXTIO_MAX_PORT; port++) {
+    getIntegerParam(*PhotronExtInSig[port], &(pConfig->extInMode[port]));
+    getIntegerParam(*PhotronExtOutSig[port], &(pConfig->extOutMode[port]));
+  }
+  getIntegerParam(PhotronVarChan, &(pConfig->varChan));
+  pConfig->valid = 1;
+}
+
+
+/** Restores the settings saved when the link was lost. They are applied in 
+  * one pass, with a single readParameters and callback at the end. The 
+  * record rate determines the available resolutions, so it is set first. 
+  * External mode is selected by the sync input, which is restored with the 
+  * other I/O ports. */
+asynStatus Photron::restoreCameraConfig() {
+  cameraConfig *pConfig = &(this->savedConfig);
+  int status = asynSuccess;
+  int port;
+  static const char *functionName = "restoreCameraConfig";
+  
+  if (!pConfig->valid) {
+    return asynSuccess;
+  }
+  
+  if (pConfig->camMode == 0) {
+    status |= setRecordRate(pConfig->recRate, 1);
+    // Update the resolution list for the restored rate
+    status |= readParameters();
+    setIntegerParam(ADSizeX, pConfig->sizeX);
+    setIntegerParam(ADSizeY, pConfig->sizeY);
+    status |= setGeometry();
+  }
+  
+  // The channel is only applied if the camera was in variable mode
+  setIntegerParam(PhotronCamMode, pConfig->camMode);
+  status |= setVariableChannel(pConfig->varChan);
+  
+  for (port=0; port<PDC_EXTIO_MAX_PORT; port++) {
+    setIntegerParam(*PhotronExtInSig[port], pConfig->extInMode[port]);
+    status |= setExternalInMode(port+1, pConfig->extInMode[port]);
+    setIntegerParam(*PhotronExtOutSig[port], pConfig->extOutMode[port]);
+    status |= setExternalOutMode(port+1, pConfig->extOutMode[port]);
+  }
+  
+  setIntegerParam(ADTriggerMode, pConfig->triggerMode);
+  setIntegerParam(PhotronAfterFrames, pConfig->afterFrames);
+  setIntegerParam(PhotronRandomFrames, pConfig->randomFrames);
+  setIntegerParam(PhotronRecCount, pConfig->recCount);
+  status |= setTriggerMode();
+  
+  status |= readParameters();
+  
+  if (status)
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s:%s: error restoring the settings of camera %s\n", 
+              driverName, functionName, this->cameraId);
+  
+  return (asynStatus)status;
+}
+
+
 /* From asynPortDriver: Disconnects driver from device; */
 asynStatus Photron::disconnect(asynUser* pasynUser) {
   return disconnectCamera();
@@ -1004,13 +2736,24 @@ asynStatus Photron::disconnectCamera() {
     return asynError;
   }
   
+  /* The threads that call the SDK without the lock must be out of it before
+     the device is closed. The callers have stopped acquisition, so they 
+     don't start another call. */
+  waitForGrab();
+  waitForPrefetch();
+  waitForArm();
+  
+  epicsMutexLock(connectMutex);
   nRet = PDC_CloseDevice(this->nDeviceNo, &nErrorCode);
+  epicsMutexUnlock(connectMutex);
   if (nRet == PDC_FAILED){
     printf("PDC_CloseDevice for device #%d did not succeed. Error code = %d\n", 
            this->nDeviceNo, nErrorCode);
   } else {
     printf("PDC_CloseDevice succeeded for device #%d\n", this->nDeviceNo);
   }
+  this->cameraConnected = 0;
+  setIntegerParam(PhotronConnectState, CONNECT_STATE_DISCONNECTED);
   
   /* Camera is disconnected. Signal to asynManager that it is disconnected. */
   status = pasynManager->exceptionDisconnect(this->pasynUserSelf);
@@ -1033,23 +2776,59 @@ asynStatus Photron::connect(asynUser* pasynUser) {
 }
 
 
+/** Connects to the camera. Called with the lock held. The lock is released
+  * while the camera is detected and opened, and ConnectState tells the 
+  * clients whether the camera is connected. A connect that is already in 
+  * progress, from another thread, makes this one fail. */
 asynStatus Photron::connectCamera() {
-  int status = asynSuccess;
+  asynStatus status;
   static const char *functionName = "connectCamera";
-  //
-  struct in_addr ipAddr;
-  unsigned long ipNumWire;
+  
+  if (this->connecting) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+      "%s:%s: already connecting to camera %s\n", 
+      driverName, functionName, this->cameraId);
+    return asynError;
+  }
+  
+  // A status poll that timed out is still inside the SDK with the old device
+  // number; the device isn't opened again until it returns
+  if (this->pollBusy) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+      "%s:%s: the last status poll of camera %s hasn't returned\n", 
+      driverName, functionName, this->cameraId);
+    return asynError;
+  }
+  
+  this->connecting = 1;
+  setIntegerParam(PhotronConnectState, CONNECT_STATE_CONNECTING);
+  callParamCallbacks();
+  
+  status = openCamera();
+  
+  this->connecting = 0;
+  setIntegerParam(PhotronConnectState, this->cameraConnected ? 
+                  CONNECT_STATE_CONNECTED : CONNECT_STATE_DISCONNECTED);
+  callParamCallbacks();
+  
+  return status;
+}
+
+
+/** Opens the camera and reads its information and settings. Called by 
+  * connectCamera with the lock held; the lock is released while the device
+  * is detected and opened. */
+asynStatus Photron::openCamera() {
+  int status = asynSuccess;
+  static const char *functionName = "openCamera";
+  //
+  struct in_addr ipAddr;
+  unsigned long ipNumWire;
   unsigned long ipNumHost;
   //
   unsigned long nRet;
   unsigned long nErrorCode;
-  PDC_DETECT_NUM_INFO DetectNumInfo;     /* Search result */
-  unsigned long IPList[PDC_MAX_DEVICE];   /* IP ADDRESS being searched */
-  
-  /* default IP address is "192.168.0.10" */
-  //IPList[0] = 0xC0A8000A;
-  /* default IP for auto-detection is "192.168.0.0" */
-  //IPList[0] = 0xC0A80000;
+  int colorMode;
   
   /* Ensure that PDC library has been initialised */
   if (!PDCLibInitialized) {
@@ -1065,70 +2844,36 @@ asynStatus Photron::connectCamera() {
   /* First disconnect from the camera */
   //disconnectCamera();
 
+  /* Resolving the name, detecting and opening the device can take seconds, 
+     or time out, so it is done without the lock. Nothing uses the camera 
+     until cameraConnected is set. */
+  this->unlock();
+  
   /* We have been given an IP address or IP name */
   status = hostToIPAddr(this->cameraId, &ipAddr);
   if (status) {
+    this->lock();
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
       "%s:%s: Cannot find IP address %s\n", 
       driverName, functionName, this->cameraId);
-    //return asynError;
+    return asynError;
   }
   ipNumWire = (unsigned long) ipAddr.s_addr;
   /* The Photron SDK needs the ip address in host byte order */
   ipNumHost = ntohl(ipNumWire);
 
-  IPList[0] = ipNumHost;
-  
-  // Attempt to detect the type of detector at the specified ip addr
-  nRet = PDC_DetectDevice(
-              PDC_INTTYPE_G_ETHER, /* Gigabit ethernet interface */
-              IPList,              /* IP address */
-              1,                   /* Max number of searched devices */
-              this->autoDetect,    /* 0=PDC_DETECT_NORMAL;1=PDC_DETECT_AUTO */
-              &DetectNumInfo,
-              &nErrorCode);
-  if (nRet == PDC_FAILED) {
-    printf("PDC_DetectDevice Error %d\n", nErrorCode);
-    return asynError;
-  }
-  
-  printf("PDC_DetectDevice \"Successful\"\n");
-  printf("\tdevice index: %d\n", DetectNumInfo.m_nDeviceNum);
-  printf("\tdevice code: %d\n", DetectNumInfo.m_DetectInfo[0].m_nDeviceCode);
-  //printf("\tnRet = %d\n", nRet);
-
-  if (DetectNumInfo.m_nDeviceNum == 0) {
-    printf("No devices detected\n");
-    return asynError;
-  }
-
-  /* only do this if not auto-searching for devices */
-  if ((this->autoDetect == PDC_DETECT_NORMAL) && 
-     (DetectNumInfo.m_DetectInfo[0].m_nTmpDeviceNo != IPList[0])) {
-    printf("The specified and detected IP addresses differ:\n");
-    printf("\tIPList[0] = %x\n", IPList[0]);
-    printf("\tm_nTmpDeviceNo = %x\n", 
-           DetectNumInfo.m_DetectInfo[0].m_nTmpDeviceNo);
+  status = openDevice(ipNumHost);
+  this->lock();
+  if (status) {
     return asynError;
   }
 
-  nRet = PDC_OpenDevice(&(DetectNumInfo.m_DetectInfo[0]), &(this->nDeviceNo),
-                        &nErrorCode);
-  /* When should PDC_OpenDevice2 be used instead of PDC_OpenDevice? */
-  //nRet = PDC_OpenDevice2(&(DetectNumInfo.m_DetectInfo[0]), 
-  //            10,  /* nMaxRetryCount */
-  //            0,  /* nConnectMode -- 1=normal, 0=safe */
-  //            &(this->nDeviceNo),
-  //            &nErrorCode);
-  if (nRet == PDC_FAILED) {
-    printf("PDC_OpenDeviceError %d\n", nErrorCode);
-    return asynError;
-  } else {
-    printf("Device #%i opened successfully\n", this->nDeviceNo);
+  /* Find the heads of a multi-head system. Settings that aren't specific to
+     a head use the first one. */
+  status = findHeads();
+  if (status) {
+    return((asynStatus)status);
   }
-
-  /* Assume only one child, for now */
-  this->nChildNo = 1;
   
   /* PDC_GetStatus is also called in readParameters(), but it is called here
      so that the camera can be put into live mode--will remove this after
@@ -1159,6 +2904,14 @@ asynStatus Photron::connectCamera() {
   status |= setIntegerParam(ADSizeY, this->sensorHeight);
   status |= setIntegerParam(ADMaxSizeX, this->sensorWidth);
   status |= setIntegerParam(ADMaxSizeY, this->sensorHeight);
+  status |= setIntegerParam(NDBayerPattern, this->bayerPattern);
+  getIntegerParam(NDColorMode, &colorMode);
+  if (this->colorType != PDC_COLORTYPE_COLOR) {
+    colorMode = NDColorModeMono;
+  } else if (colorMode != NDColorModeRGB1) {
+    colorMode = NDColorModeBayer;
+  }
+  status |= setIntegerParam(NDColorMode, colorMode);
   //
   status |= setIntegerParam(PhotronVarChan, 1);
   status |= setIntegerParam(PhotronMemIRIGDay, 0);
@@ -1182,6 +2935,8 @@ asynStatus Photron::connectCamera() {
     return((asynStatus)status);
   }
   
+  this->cameraConnected = 1;
+  
   /* We found the camera. Everything is OK. Signal to asynManager that we are 
      connected. */
   status = pasynManager->exceptionConnect(this->pasynUserSelf);
@@ -1197,6 +2952,217 @@ asynStatus Photron::connectCamera() {
   return asynSuccess;
 }
 
+/** Detects the camera at the given address and opens it. Called without the
+  * lock, because detection can take seconds or time out. A camera at a known
+  * address is detected in parallel with the other cameras; only an 
+  * auto-detect search and PDC_OpenDevice, which changes the SDK's device 
+  * table, hold connectMutex.
+  * \param[in] ipNumHost IP address of the camera in host byte order
+  */
+asynStatus Photron::openDevice(unsigned long ipNumHost) {
+  unsigned long nRet;
+  unsigned long nErrorCode;
+  unsigned long nDeviceNo;
+  PDC_DETECT_NUM_INFO DetectNumInfo;     /* Search result */
+  unsigned long IPList[PDC_MAX_DEVICE];   /* IP ADDRESS being searched */
+  
+  /* default IP address is "192.168.0.10" */
+  //IPList[0] = 0xC0A8000A;
+  /* default IP for auto-detection is "192.168.0.0" */
+  //IPList[0] = 0xC0A80000;
+  IPList[0] = ipNumHost;
+  
+  if (this->autoDetect != PDC_DETECT_NORMAL) {
+    epicsMutexLock(connectMutex);
+  }
+  // Attempt to detect the type of detector at the specified ip addr
+  nRet = PDC_DetectDevice(
+              PDC_INTTYPE_G_ETHER, /* Gigabit ethernet interface */
+              IPList,              /* IP address */
+              1,                   /* Max number of searched devices */
+              this->autoDetect,    /* 0=PDC_DETECT_NORMAL;1=PDC_DETECT_AUTO */
+              &DetectNumInfo,
+              &nErrorCode);
+  if (this->autoDetect != PDC_DETECT_NORMAL) {
+    epicsMutexUnlock(connectMutex);
+  }
+  if (nRet == PDC_FAILED) {
+    printf("PDC_DetectDevice Error %d\n", nErrorCode);
+    return asynError;
+  }
+  
+  printf("PDC_DetectDevice \"Successful\"\n");
+  printf("\tdevice index: %d\n", DetectNumInfo.m_nDeviceNum);
+  printf("\tdevice code: %d\n", DetectNumInfo.m_DetectInfo[0].m_nDeviceCode);
+  //printf("\tnRet = %d\n", nRet);
+
+  if (DetectNumInfo.m_nDeviceNum == 0) {
+    printf("No devices detected\n");
+    return asynError;
+  }
+
+  /* only do this if not auto-searching for devices */
+  if ((this->autoDetect == PDC_DETECT_NORMAL) && 
+     (DetectNumInfo.m_DetectInfo[0].m_nTmpDeviceNo != IPList[0])) {
+    printf("The specified and detected IP addresses differ:\n");
+    printf("\tIPList[0] = %x\n", IPList[0]);
+    printf("\tm_nTmpDeviceNo = %x\n", 
+           DetectNumInfo.m_DetectInfo[0].m_nTmpDeviceNo);
+    return asynError;
+  }
+
+  epicsMutexLock(connectMutex);
+  nRet = PDC_OpenDevice(&(DetectNumInfo.m_DetectInfo[0]), &nDeviceNo,
+                        &nErrorCode);
+  /* When should PDC_OpenDevice2 be used instead of PDC_OpenDevice? */
+  //nRet = PDC_OpenDevice2(&(DetectNumInfo.m_DetectInfo[0]), 
+  //            10,  /* nMaxRetryCount */
+  //            0,  /* nConnectMode -- 1=normal, 0=safe */
+  //            &(this->nDeviceNo),
+  //            &nErrorCode);
+  epicsMutexUnlock(connectMutex);
+  if (nRet == PDC_FAILED) {
+    printf("PDC_OpenDeviceError %d\n", nErrorCode);
+    return asynError;
+  } else {
+    printf("Device #%i opened successfully\n", nDeviceNo);
+  }
+  
+  this->nDeviceNo = nDeviceNo;
+  return asynSuccess;
+}
+
+
+/** Finds the heads of a multi-head system and activates them. The first 
+  * head is used for live images, the preview and all settings that aren't 
+  * specific to a head. */
+asynStatus Photron::findHeads() {
+  unsigned long nRet;
+  unsigned long nErrorCode;
+  unsigned long size = 0, index;
+  unsigned long childList[PDC_MAX_LIST_NUMBER];
+  int head;
+  
+  this->numHeads = 1;
+  this->headChildNo[0] = 1;
+  
+  if (this->maxHeads > 1) {
+    nRet = PDC_GetExistChildDeviceList(this->nDeviceNo, &size, childList, 
+                                       &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetExistChildDeviceList failed %d; using one head\n", 
+             nErrorCode);
+    } else if (size > 0) {
+      this->numHeads = 0;
+      for (index=0; (index<size) && (this->numHeads<this->maxHeads); index++) {
+        this->headChildNo[this->numHeads] = childList[index];
+        this->numHeads++;
+      }
+    }
+    
+    for (head=0; head<this->numHeads; head++) {
+      nRet = PDC_SetActiveChild(this->nDeviceNo, this->headChildNo[head], 
+                                PDC_FUNCTION_ON, &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_SetActiveChild failed %d; head = %d\n", nErrorCode, 
+               head+1);
+        return asynError;
+      }
+    }
+    printf("Using %d of %d heads\n", this->numHeads, (int)size);
+  }
+  
+  this->nChildNo = this->headChildNo[0];
+  for (head=0; head<this->numHeads; head++) {
+    this->headMemWidth[head] = 0;
+    this->headMemHeight[head] = 0;
+  }
+  setIntegerParam(PhotronNumHeads, this->numHeads);
+  
+  return asynSuccess;
+}
+
+
+/** Reads the geometry of the other heads of a multi-head system into the 
+  * parameters of their asyn addresses. The first head's geometry is read by
+  * getGeometry. */
+asynStatus Photron::readHeadGeometry() {
+  unsigned long nRet;
+  unsigned long nErrorCode;
+  unsigned long width, height;
+  int head;
+  
+  for (head=1; head<this->numHeads; head++) {
+    nRet = PDC_GetMaxResolution(this->nDeviceNo, this->headChildNo[head], 
+                                &width, &height, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetMaxResolution failed %d; head = %d\n", nErrorCode, head+1);
+      return asynError;
+    }
+    setIntegerParam(head, ADMaxSizeX, width);
+    setIntegerParam(head, ADMaxSizeY, height);
+    
+    nRet = PDC_GetResolution(this->nDeviceNo, this->headChildNo[head], 
+                             &width, &height, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetResolution failed %d; head = %d\n", nErrorCode, head+1);
+      return asynError;
+    }
+    setIntegerParam(head, ADSizeX, width);
+    setIntegerParam(head, ADSizeY, height);
+    callParamCallbacks(head);
+  }
+  
+  return asynSuccess;
+}
+
+
+/** Handles int32 writes to the other heads of a multi-head system. Only 
+  * their resolution can be set; the other settings are shared with the 
+  * first head. Writes to base class parameters, e.g. NDArrayCallbacks, are 
+  * stored for the head's address. */
+asynStatus Photron::writeHeadInt32(asynUser *pasynUser, int addr, 
+                                   epicsInt32 value) {
+  int function = pasynUser->reason;
+  int status = asynSuccess;
+  int sizeX, sizeY;
+  unsigned long nRet;
+  unsigned long nErrorCode;
+  static const char *functionName = "writeHeadInt32";
+  
+  if (addr >= this->numHeads) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: head %d doesn't exist\n", driverName, functionName, 
+              addr+1);
+    return asynError;
+  }
+  
+  if ((function == ADSizeX) || (function == ADSizeY)) {
+    setIntegerParam(addr, function, value);
+    getIntegerParam(addr, ADSizeX, &sizeX);
+    getIntegerParam(addr, ADSizeY, &sizeY);
+    nRet = PDC_SetResolution(this->nDeviceNo, this->headChildNo[addr], 
+                             sizeX, sizeY, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_SetResolution Error %d; head = %d\n", nErrorCode, addr+1);
+      status = asynError;
+    }
+    // Read back the resolution the head actually uses
+    status |= readHeadGeometry();
+  } else if (function < FIRST_PHOTRON_PARAM) {
+    status = ADDriver::writeInt32(pasynUser, value);
+  } else {
+    status = asynError;
+  }
+  
+  asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+            "%s:%s: head=%d, function=%d, value=%d, status=%d\n",
+            driverName, functionName, addr+1, function, value, status);
+  
+  return (asynStatus)status;
+}
+
+
 /** Read camera-specific settings and values from the camera.
  * This function will collect values from the camera that aren't expected
  * to change during operation and set the appropriate integer/double parameters
@@ -1210,6 +3176,8 @@ asynStatus Photron::getCameraInfo() {
   unsigned long nErrorCode;
   int status = asynSuccess;
   char sensorBitChar;
+  char colorTypeChar;
+  unsigned long bayerAlign;
   static const char *functionName = "getCameraInfo";
   //
   int index;
@@ -1311,6 +3279,39 @@ asynStatus Photron::getCameraInfo() {
     this->sensorBits = (unsigned long) sensorBitChar;
   }
   
+  // Color cameras transfer their raw Bayer data (see setTransferOption)
+  nRet = PDC_GetColorType(this->nDeviceNo, this->nChildNo, &colorTypeChar,
+                          &nErrorCode);
+  if (nRet == PDC_FAILED) {
+    printf("PDC_GetColorType failed %d\n", nErrorCode);
+    return asynError;
+  } else {
+    this->colorType = (unsigned long) colorTypeChar;
+  }
+  
+  this->bayerPattern = NDBayerRGGB;
+  if (this->colorType == PDC_COLORTYPE_COLOR) {
+    nRet = PDC_GetBayerAlignment(this->nDeviceNo, &bayerAlign, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetBayerAlignment failed %d; assuming RGGB\n", nErrorCode);
+      bayerAlign = PDC_BAYER_ALIGNMENT_RGGB;
+    }
+    switch (bayerAlign) {
+      case PDC_BAYER_ALIGNMENT_BGGR:
+        this->bayerPattern = NDBayerBGGR;
+        break;
+      case PDC_BAYER_ALIGNMENT_GRBG:
+        this->bayerPattern = NDBayerGRBG;
+        break;
+      case PDC_BAYER_ALIGNMENT_GBRG:
+        this->bayerPattern = NDBayerGBRG;
+        break;
+      default:
+        this->bayerPattern = NDBayerRGGB;
+        break;
+    }
+  }
+  
   nRet = PDC_GetExternalCount(this->nDeviceNo, &(this->inPorts), 
                               &(this->outPorts), &nErrorCode);
   if (nRet == PDC_FAILED) {
@@ -1395,51 +3396,17 @@ asynStatus Photron::getCameraInfo() {
 }
 
 asynStatus Photron::readImage() {
-  int status = asynSuccess;
-  //
-  int sizeX, sizeY;
-  size_t dims[2];
-  double gain;
-  //
   NDArray *pImage;
   NDArrayInfo_t arrayInfo;
-  int colorMode = NDColorModeMono;
-  //
-  unsigned long nRet;
-  unsigned long nErrorCode;
-  void *pBuf;  /* Memory sequence pointer for storing a live image */
-  //
-  NDDataType_t dataType;
-  int pixelSize;
-  size_t dataSize;
-  static const char *functionName = "readImage";
+  asynStatus status;
 
-  getIntegerParam(ADSizeX,  &sizeX);
-  getIntegerParam(ADSizeY,  &sizeY);
-  getDoubleParam (ADGain,   &gain);
-  
-  if (this->pixelBits == 8) {
-    // 8 bits
-    dataType = NDUInt8;
-    pixelSize = 1;
-  } else {
-    // 12 bits (stored in 2 bytes)
-    dataType = NDUInt16;
-    pixelSize = 2;
+  status = grabLiveImage(&pImage, 0);
+  if (status != asynSuccess) {
+    return status;
   }
-  
-  //printf("sizeof(epicsUInt8) = %d\n", sizeof(epicsUInt8));
-  //printf("sizeof(epicsUInt16) = %d\n", sizeof(epicsUInt16));
-  
-  dataSize = sizeX * sizeY * pixelSize;
-  pBuf = malloc(dataSize);
-  
-  nRet = PDC_GetLiveImageData(this->nDeviceNo, this->nChildNo,
-                              this->pixelBits,
-                              pBuf, &nErrorCode);
-  if (nRet == PDC_FAILED) {
-    printf("PDC_GetLiveImageData Failed. Error %d\n", nErrorCode);
-    free(pBuf);
+  pImage = correctFrame(pImage, NULL);
+  pImage = convertColor(pImage, NULL, NULL);
+  if (!pImage) {
     return asynError;
   }
 
@@ -1448,6 +3415,141 @@ asynStatus Photron::readImage() {
   if (this->pArrays[0]) 
     this->pArrays[0]->release();
   
+  this->pArrays[0] = pImage;
+  pImage->getInfo(&arrayInfo);
+  setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
+  setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+  setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+  
+  return asynSuccess;
+}
+
+
+/** Reads a live image from the camera directly into an NDArray from the pool.
+  * If frame numbers are enabled and the camera supports it, the image is 
+  * copied from the SDK's live image buffer along with its frame number, which
+  * is stored in the LiveFrameNumber attribute. Called with the lock held, 
+  * which is released during the SDK calls and the copy. grabBusy is held for
+  * the whole transfer, so the resolution and pixel format can't change until
+  * it is done.
+  * \param[out] ppImage The new image. The caller owns the reference.
+  * \param[in] skipDuplicate Return asynSuccess with *ppImage set to NULL if 
+  *            the camera hasn't produced a new frame since the last image, or
+  *            if the frame was dropped because its size changed.
+  */
+asynStatus Photron::grabLiveImage(NDArray **ppImage, int skipDuplicate) {
+  asynStatus status;
+  
+  this->grabBusy++;
+  status = transferLiveImage(ppImage, skipDuplicate);
+  this->grabBusy--;
+  if (this->grabBusy == 0) {
+    epicsEventSignal(this->grabIdleEventId);
+  }
+  return status;
+}
+
+
+/** Waits until no live transfer is in progress without the lock. Called with
+  * the lock held before the resolution or the pixel format is changed; no new
+  * transfer can start until the caller releases the lock. */
+void Photron::waitForGrab() {
+  while (this->grabBusy) {
+    this->unlock();
+    epicsEventWait(this->grabIdleEventId);
+    this->lock();
+  }
+  // Pass the event on to any other thread waiting for the same transfer
+  epicsEventSignal(this->grabIdleEventId);
+}
+
+
+/** Waits until armForGroup isn't in a PDC call without the lock. Called with
+  * the lock held before the device is closed. */
+void Photron::waitForArm() {
+  while (this->armBusy) {
+    this->unlock();
+    epicsEventWait(this->armIdleEventId);
+    this->lock();
+  }
+}
+
+
+/** Does the work of grabLiveImage. */
+asynStatus Photron::transferLiveImage(NDArray **ppImage, int skipDuplicate) {
+  int sizeX, sizeY;
+  size_t dims[2];
+  //
+  NDArray *pImage;
+  int colorMode = NDColorModeMono;
+  int frameNumbers;
+  epicsUInt32 frameNoAttr;
+  epicsTimeStamp grabTime, beforeIRIG, afterIRIG;
+  //
+  unsigned long nRet, irigRet = PDC_FAILED;
+  unsigned long nErrorCode, irigErrorCode = 0;
+  unsigned long nFrameNo;
+  void *pSrc;
+  int irig;
+  PDC_IRIG_INFO tData;
+  //
+  NDDataType_t dataType;
+  int pixelSize, pixelBits;
+  int newSizeX, newSizeY;
+  int dropped;
+  static const char *functionName = "grabLiveImage";
+
+  *ppImage = NULL;
+  
+  epicsTimeGetCurrent(&grabTime);
+  
+  getIntegerParam(ADSizeX,  &sizeX);
+  getIntegerParam(ADSizeY,  &sizeY);
+  getIntegerParam(PhotronLiveFrameNumbers, &frameNumbers);
+  pixelBits = this->pixelBits;
+  
+  if (pixelBits == 8) {
+    // 8 bits
+    dataType = NDUInt8;
+    pixelSize = 1;
+  } else {
+    // 12 bits (stored in 2 bytes)
+    dataType = NDUInt16;
+    pixelSize = 2;
+  }
+  
+  /* The live IRIG time is that of the newest frame when it is read, so it 
+   * is read right after the frame is chosen, or before the transfer if the
+   * transfer chooses it. Only a frame that the camera produces between the
+   * two calls makes the stamp belong to the previous frame, up to one frame
+   * period early. */
+  irig = this->IRIG && 
+         (this->functionList[PDC_EXIST_LIVE_IRIG] == PDC_EXIST_SUPPORTED);
+  
+  if (frameNumbers && 
+      (this->functionList[PDC_EXIST_IMAGE_ADDRESS] == PDC_EXIST_SUPPORTED)) {
+    this->unlock();
+    nRet = PDC_GetLiveImageAddress2(this->nDeviceNo, this->nChildNo,
+                                    &nFrameNo, &pSrc, &nErrorCode);
+    if ((nRet != PDC_FAILED) && irig) {
+      epicsTimeGetCurrent(&beforeIRIG);
+      irigRet = PDC_GetLiveIRIGData(this->nDeviceNo, &tData, &irigErrorCode);
+      epicsTimeGetCurrent(&afterIRIG);
+    }
+    this->lock();
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetLiveImageAddress2 Failed. Error %d\n", nErrorCode);
+      checkLinkError(nErrorCode);
+      return asynError;
+    }
+    
+    if (skipDuplicate && this->liveFrameValid && (nFrameNo == this->liveFrameNo)) {
+      return asynSuccess;
+    }
+  } else {
+    frameNumbers = 0;
+  }
+  
   /* Allocate the raw buffer */
   dims[0] = sizeX;
   dims[1] = sizeY;
@@ -1458,17 +3560,170 @@ asynStatus Photron::readImage() {
     return(asynError);
   }
   
-  memcpy(pImage->pData, pBuf, dataSize);
+  /* The transfer is done without the lock, so that parameter writes and 
+   * the other threads of the driver aren't held up by it */
+  this->unlock();
+  if (frameNumbers) {
+    // The live image buffer has the format selected by the transfer option
+    memcpy(pImage->pData, pSrc, sizeX * sizeY * pixelSize);
+    nRet = PDC_SUCCEEDED;
+  } else {
+    if (irig) {
+      epicsTimeGetCurrent(&beforeIRIG);
+      irigRet = PDC_GetLiveIRIGData(this->nDeviceNo, &tData, &irigErrorCode);
+      epicsTimeGetCurrent(&afterIRIG);
+    }
+    nRet = PDC_GetLiveImageData(this->nDeviceNo, this->nChildNo,
+                                pixelBits,
+                                pImage->pData, &nErrorCode);
+  }
+  this->lock();
+  
+  if (nRet == PDC_FAILED) {
+    printf("PDC_GetLiveImageData Failed. Error %d\n", nErrorCode);
+    checkLinkError(nErrorCode);
+    pImage->release();
+    return asynError;
+  }
+  
+  // The frame must still have the size it was allocated for
+  getIntegerParam(ADSizeX, &newSizeX);
+  getIntegerParam(ADSizeY, &newSizeY);
+  if ((newSizeX != sizeX) || (newSizeY != sizeY) || 
+      (this->pixelBits != pixelBits)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: the frame size changed during the transfer; frame dropped\n",
+              driverName, functionName);
+    pImage->release();
+    if (skipDuplicate) {
+      // The grab task carries on with the next frame
+      getIntegerParam(PhotronLiveDropped, &dropped);
+      setIntegerParam(PhotronLiveDropped, dropped + 1);
+      return asynSuccess;
+    }
+    return asynError;
+  }
+  
+  if (frameNumbers) {
+    updateLiveFrameStats(nFrameNo);
+    frameNoAttr = (epicsUInt32)nFrameNo;
+    pImage->pAttributeList->add("LiveFrameNumber", "Camera frame number",
+                                NDAttrUInt32, &frameNoAttr);
+  }
   
-  this->pArrays[0] = pImage;
   pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
                               &colorMode);
+  
+  /* Use the camera's IRIG time for the live frame if it is available. 
+   * Otherwise use the host time at which the transfer started. */
+  updateTimeStamp(&pImage->epicsTS);
+  if (irig) {
+    if (irigRet == PDC_FAILED) {
+      printf("PDC_GetLiveIRIGData Failed. Error %d\n", irigErrorCode);
+    } else {
+      /* Periodically correlate the camera's clock with the host's. The live
+       * IRIG time is that of the newest frame, so the offset includes up to
+       * one frame period of latency. */
+      if (epicsTimeDiffInSeconds(&afterIRIG, &(this->irigLastSampleTime)) >= IRIG_SAMPLE_PERIOD) {
+        addIRIGSample(&tData, &beforeIRIG, &afterIRIG);
+      }
+      timeDataToTimeStamp(&tData, &grabTime);
+      pImage->epicsTS = grabTime;
+    }
+  }
+  pImage->timeStamp = grabTime.secPastEpoch + grabTime.nsec / 1.e9;
+  
+  *ppImage = pImage;
+  return asynSuccess;
+}
+
+
+/** Updates the frame-number statistics for a live image. Frames the camera
+  * produced between two live images are counted as skipped. The delivered
+  * and sensor rates are updated about once a second. */
+void Photron::updateLiveFrameStats(unsigned long frameNo) {
+  epicsTimeStamp now;
+  unsigned long skipped;
+  int totalSkipped;
+  double elapsed;
+  
+  epicsTimeGetCurrent(&now);
+  
+  if (!this->liveFrameValid) {
+    this->liveFrameValid = 1;
+    this->liveRateTime = now;
+    this->liveRateFrameNo = frameNo;
+    this->liveRateCount = 0;
+  } else if (frameNo != this->liveFrameNo) {
+    // Unsigned arithmetic handles the frame number wrapping around
+    skipped = frameNo - this->liveFrameNo - 1;
+    if (skipped > 0) {
+      getIntegerParam(PhotronLiveSkipped, &totalSkipped);
+      setIntegerParam(PhotronLiveSkipped, totalSkipped + (int)skipped);
+    }
+  } else {
+    // The same frame was read again
+    return;
+  }
+  
+  this->liveFrameNo = frameNo;
+  this->liveRateCount++;
+  setIntegerParam(PhotronLiveFrameNo, (int)frameNo);
+  
+  elapsed = epicsTimeDiffInSeconds(&now, &this->liveRateTime);
+  if (elapsed >= 1.0) {
+    setDoubleParam(PhotronLiveDeliveredRate, this->liveRateCount / elapsed);
+    setDoubleParam(PhotronLiveSensorRate, 
+                   (frameNo - this->liveRateFrameNo) / elapsed);
+    this->liveRateTime = now;
+    this->liveRateFrameNo = frameNo;
+    this->liveRateCount = 0;
+  }
+}
+
+
+/** Waits for PhotronGrabTask to provide a live image that hasn't been 
+  * published yet and makes it the current image. Returns asynError if 
+  * acquisition stops while waiting. */
+asynStatus Photron::readLatestImage() {
+  NDArray *pImage;
+  NDArrayInfo_t arrayInfo;
+  int acquire, grabber;
+
+  while (1) {
+    epicsMutexLock(this->liveMutex);
+    pImage = this->liveLatest;
+    this->liveLatest = NULL;
+    epicsMutexUnlock(this->liveMutex);
+    
+    if (pImage) {
+      break;
+    }
+    
+    getIntegerParam(ADAcquire, &acquire);
+    if (!acquire) {
+      return asynError;
+    }
+    
+    getIntegerParam(PhotronLiveGrabber, &grabber);
+    if (!grabber) {
+      /* The grabber was disabled while waiting */
+      return readImage();
+    }
+    
+    this->unlock();
+    epicsEventWaitWithTimeout(this->liveFrameEventId, 0.1);
+    this->lock();
+  }
+  
+  if (this->pArrays[0]) 
+    this->pArrays[0]->release();
+  
+  this->pArrays[0] = pImage;
   pImage->getInfo(&arrayInfo);
   setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
-  setIntegerParam(NDArraySizeX, (int)pImage->dims[0].size);
-  setIntegerParam(NDArraySizeY, (int)pImage->dims[1].size);
-
-  free(pBuf);
+  setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+  setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
   
   return asynSuccess;
 }
@@ -1484,8 +3739,15 @@ asynStatus Photron::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
     asynStatus status = asynSuccess;
     int function = pasynUser->reason;
     double tempVal;
+    int addr;
     static const char *functionName = "writeFloat64";
     
+    // The other heads of a multi-head system have no float64 settings
+    getAddress(pasynUser, &addr);
+    if (addr > 0) {
+      return ADDriver::writeFloat64(pasynUser, value);
+    }
+    
     /* Set the value in the parameter library.  This may change later but that's OK */
     status = setDoubleParam(function, value);
     
@@ -1522,12 +3784,20 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   int function = pasynUser->reason;
   int status = asynSuccess;
   int adstatus, acqMode, chan, syncPulse;
+  int group;
   int index;
   int skipReadParams = 0;
   epicsInt32 oldValue;
   epicsInt32 phostat, functionToAllow, functionToReject;
+  int addr;
   static const char *functionName = "writeInt32";
   
+  // Writes to the other heads of a multi-head system
+  getAddress(pasynUser, &addr);
+  if (addr > 0) {
+    return writeHeadInt32(pasynUser, addr, value);
+  }
+  
   //printf("FUNCTION: %d - VALUE: %d\n", function, value);
   
   // Save the old value. Don't |= it with status to avoid errors at startup
@@ -1543,8 +3813,23 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   // Determine if function is one of the preview-mode functions
   // NOTE: The ranges are carefully chosed so that PhotronPMPlayFPS, 
   //       PhotronPMPlayMult and PhotronPMRepeat can be changed at any time
-  functionToAllow = ((function >= PhotronPMStart) && (function <= PhotronPMRepeat));
-  functionToReject = ((function >= PhotronPMStart) && (function <= PhotronPMCancel));
+  functionToAllow = ((function >= PhotronPMStart) && (function <= PhotronPMRepeat)) ||
+                    (function == PhotronPMCacheBudget) ||
+                    (function == PhotronPMPrefetchAhead) ||
+                    (function == PhotronPMPrefetchBehind) ||
+                    (function == PhotronPMAddRange) ||
+                    (function == PhotronPMClearRanges) ||
+                    (function == PhotronReadoutPriority) ||
+                    (function == PhotronReadoutShare) ||
+                    (function == PhotronAutoReconnect) ||
+                    (function == PhotronCorrMode) ||
+                    (function == PhotronCorrOutput) ||
+                    (function == PhotronPixelGainCorr) ||
+                    (function == NDColorMode) ||
+                    (function == PhotronCompress);
+  functionToReject = ((function >= PhotronPMStart) && (function <= PhotronPMCancel)) ||
+                     (function == PhotronPMAddRange) ||
+                     (function == PhotronPMClearRanges);
   
   if ((phostat == PDC_STATUS_SAVE) || (phostat == PDC_STATUS_LOAD) || (this->forceWait == 1)) {
     // Don't allow any PVs to change while camera is the state
@@ -1594,11 +3879,19 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
         * It won't actually start generating new images until we release the lock
         * below */
         epicsEventSignal(this->startEventId);
+        epicsEventSignal(this->startGrabEventId);
+        // Restart the live frame statistics
+        this->liveFrameValid = 0;
+        setIntegerParam(PhotronLiveSkipped, 0);
+        setDoubleParam(PhotronLiveDeliveredRate, 0.0);
+        setDoubleParam(PhotronLiveSensorRate, 0.0);
       }
       if (!value && (adstatus != ADStatusIdle)) {
         /* This was a command to stop acquisition */
         /* Send the stop event */
         epicsEventSignal(this->stopEventId);
+        epicsEventSignal(this->liveFrameEventId);
+        epicsEventSignal(this->startGrabEventId);
       }
     } else {
       // For Record mode
@@ -1611,6 +3904,8 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
         if (adstatus != ADStatusWaiting) {
           // Stop current (or next) readout
           this->abortFlag = 1;
+          // Wake up the readout if it is waiting for free buffers
+          epicsEventSignal(this->freeBufferEventId);
           setIntegerParam(ADAcquire, 0);
           if (adstatus == ADStatusAcquire) {
             // Abort acquisition if it is in progress
@@ -1757,9 +4052,11 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
     skipReadParams = 1;
   } else if (function == PhotronPMStart) {
     setPreviewRange(function, value);
+    this->playScheduleChanged = 1;
     skipReadParams = 1;
   } else if (function == PhotronPMEnd) {
     setPreviewRange(function, value);
+    this->playScheduleChanged = 1;
     skipReadParams = 1;
   } else if (function == PhotronPMPlay) {
     if (value == 1) {
@@ -1770,6 +4067,7 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
       
       // Set the dir flag
       this->dirFlag = 1;
+      this->prefetchDir = 1;
       
       // Wake up the PhotronPlayTask
       epicsEventSignal(this->startPlayEventId);
@@ -1791,6 +4089,7 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
       
       // Set the dir flag
       this->dirFlag = 0;
+      this->prefetchDir = 0;
       
       // Wake up the PhotronPlayTask
       epicsEventSignal(this->startPlayEventId);
@@ -1807,15 +4106,132 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
     if (value < 1) {
       setIntegerParam(PhotronPMPlayFPS, 1);
     }
+    this->playScheduleChanged = 1;
     skipReadParams = 1;
   } else if (function == PhotronPMPlayMult) {
     if (value < 1) {
       setIntegerParam(PhotronPMPlayMult, 1);
     }
+    this->playScheduleChanged = 1;
     skipReadParams = 1;
   } else if (function == PhotronPMRepeat) {
-    // Do nothing
-    printf("PhotronPMRepeat: value = %d\n", value);
+    this->playScheduleChanged = 1;
+    skipReadParams = 1;
+  } else if (function == PhotronPMCacheBudget) {
+    if (value < 0) {
+      setIntegerParam(PhotronPMCacheBudget, 0);
+      value = 0;
+    }
+    // Evict frames if the budget shrank
+    previewCacheTrim((size_t)value * 1024 * 1024);
+    updatePreviewCacheParams();
+    skipReadParams = 1;
+  } else if ((function == PhotronPMPrefetchAhead) || 
+             (function == PhotronPMPrefetchBehind)) {
+    if (value < 0) {
+      setIntegerParam(function, 0);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronReadoutPriority) {
+    // Do nothing. This param is checked by acquireReadoutSlot
+    skipReadParams = 1;
+  } else if (function == PhotronReadoutShare) {
+    if (value < 1) {
+      setIntegerParam(PhotronReadoutShare, 1);
+    }
+    skipReadParams = 1;
+  } else if ((function == PhotronCorrMode) || (function == PhotronCorrOutput)) {
+    // Do nothing. These params are checked by correctFrame
+    skipReadParams = 1;
+  } else if (function == PhotronCorrFrames) {
+    if (value < 1) {
+      setIntegerParam(PhotronCorrFrames, 1);
+    }
+    skipReadParams = 1;
+  } else if ((function == PhotronCorrCaptureDark) || 
+             (function == PhotronCorrCaptureFlat)) {
+    if ((value == 1) && !this->captureBusy) {
+      // PhotronCaptureTask resets the command when the capture is done
+      this->captureBusy = 1;
+      this->captureFunction = function;
+      epicsEventSignal(this->captureEventId);
+    } else if ((value == 1) && (function != this->captureFunction)) {
+      printf("%s:%s: a reference is already being captured\n", driverName,
+             functionName);
+      setIntegerParam(function, 0);
+      status = asynError;
+    }
+    skipReadParams = 1;
+#ifndef HAVE_BITSHUFFLE
+  } else if ((function == PhotronCompress) && (value != COMPRESS_NONE)) {
+    // Compression needs a build with LZ4 and bitshuffle
+    printf("%s:%s: the driver was built without LZ4 and bitshuffle\n", 
+           driverName, functionName);
+    setIntegerParam(PhotronCompress, oldValue);
+    status = asynError;
+    skipReadParams = 1;
+#endif
+  } else if (function == PhotronCompress) {
+    this->compressCodec = value;
+    setStringParam(NDCodec, (value == COMPRESS_LZ4) ? "lz4" :
+                            (value == COMPRESS_BSLZ4) ? "bslz4" : "");
+    skipReadParams = 1;
+  } else if (function == NDColorMode) {
+    // Mono cameras only produce mono data. Color cameras produce Bayer data,
+    // which the driver can convert to RGB1.
+    if (this->colorType != PDC_COLORTYPE_COLOR) {
+      value = NDColorModeMono;
+    } else if (value != NDColorModeRGB1) {
+      value = NDColorModeBayer;
+    }
+    setIntegerParam(NDColorMode, value);
+    skipReadParams = 1;
+  } else if (function == PhotronPixelGainCorr) {
+    if (value) {
+      // Download the table again; the camera may have been recalibrated
+      status |= loadPixelGain(1);
+      if (status) {
+        setIntegerParam(PhotronPixelGainCorr, 0);
+      }
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronCorrClear) {
+    if (value == 1) {
+      clearCorrectionRefs(1);
+      setIntegerParam(PhotronCorrClear, 0);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronAutoReconnect) {
+    // Let the supervisor reconnect now if the camera is disconnected
+    if (value) {
+      epicsEventSignal(this->supervisorEventId);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronSyncGroup) {
+    if (value < 0) {
+      setIntegerParam(PhotronSyncGroup, 0);
+    }
+    skipReadParams = 1;
+  } else if ((function == PhotronGroupArm) || (function == PhotronGroupTrigger)) {
+    getIntegerParam(PhotronSyncGroup, &group);
+    if ((value == 1) && (group > 0)) {
+      // The group controller resets the command when the group is done
+      queueGroupRequest(group, (function == PhotronGroupTrigger));
+    } else {
+      if (value == 1) {
+        printf("Camera %s isn't in a sync group\n", this->portName);
+      }
+      setIntegerParam(function, 0);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronSplitRecordings) {
+    // Do nothing. This param is checked by readImageRange
+    skipReadParams = 1;
+  } else if (function == PhotronPMAddRange) {
+    addSaveRange();
+    skipReadParams = 1;
+  } else if (function == PhotronPMClearRanges) {
+    clearSaveRanges();
     skipReadParams = 1;
   } else if (function == PhotronPMCancel) {
     // TODO: do nothing if not it playback mode
@@ -1862,6 +4278,32 @@ asynStatus Photron::writeInt32(asynUser *pasynUser, epicsInt32 value) {
     }
   } else if (function == PhotronBurstTrans) {
     setBurstTransfer(value);
+  } else if (function == PhotronReadoutLossless) {
+    // Do nothing. This param is checked by readImageRange
+    skipReadParams = 1;
+  } else if (function == PhotronReadoutMaxInFlight) {
+    if (value < 1) {
+      setIntegerParam(PhotronReadoutMaxInFlight, 1);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronReadoutReserve) {
+    if (value < 0) {
+      setIntegerParam(PhotronReadoutReserve, 0);
+    }
+    skipReadParams = 1;
+  } else if (function == PhotronLiveFrameNumbers) {
+    if (value && (this->functionList[PDC_EXIST_IMAGE_ADDRESS] != PDC_EXIST_SUPPORTED)) {
+      printf("Live frame numbers aren't supported by this camera\n");
+      setIntegerParam(PhotronLiveFrameNumbers, 0);
+    }
+    this->liveFrameValid = 0;
+    skipReadParams = 1;
+  } else if (function == PhotronLiveGrabber) {
+    // Start grabbing if live acquisition is already in progress
+    if (value) {
+      epicsEventSignal(this->startGrabEventId);
+    }
+    skipReadParams = 1;
   } else if (function == PhotronTest) {
     // Set status to asynSuccess if value is divisible by 4, asynError otherwise
     if ((value % 4) == 0) {
@@ -2316,65 +4758,316 @@ asynStatus Photron::softwareTrigger() {
 }
 
 
-asynStatus Photron::setRecReady() {
-  asynStatus status = asynSuccess;
-  int acqMode, mode, apiMode;
-  unsigned long nRet, nErrorCode;
-  static const char *functionName = "setRecReady";
-  
-  status = getIntegerParam(PhotronAcquireMode, &acqMode);
+/** Queues a GroupArm or GroupTrigger for the group controller thread. A 
+  * request for a group that is already queued isn't queued again. */
+void Photron::queueGroupRequest(int group, int trigger) {
+  groupRequest *pRequest;
   
-  // Only set rec ready if in record mode
-  if (acqMode == 1) {
-    nRet = PDC_SetRecReady(nDeviceNo, &nErrorCode);
-    if (nRet == PDC_FAILED) {
-      printf("PDC_SetRecReady failed. error = %d\n", nErrorCode);
-      return asynError;
+  epicsMutexLock(groupMutex);
+  pRequest = (groupRequest *)ellFirst(&groupQueue);
+  while (pRequest) {
+    if (pRequest->group == group) {
+      pRequest->trigger |= trigger;
+      break;
     }
-    
-    // This code is duplicated in setTriggerMode
-    getIntegerParam(ADTriggerMode, &mode);
-    
-    // The mode isn't in the right format for the PDC_SetTriggerMode call
-    apiMode = this->trigModeToAPI(mode);
-    
-    // Set endless for trigger modes that need it
-    switch (apiMode) {
-      case PDC_TRIGGER_CENTER:
-      case PDC_TRIGGER_END:
-      case PDC_TRIGGER_MANUAL:
-      // Setting endless mode for random modes generates an extra recording
-      // but only if fewer than the specified number of recordings are generated
-      case PDC_TRIGGER_RANDOM_CENTER:
-      case PDC_TRIGGER_RANDOM_MANUAL:
-        // The SA-Z needs a delay to reliably enter endless mode
-        epicsThreadSleep(0.5);
-        setEndless();
-        break;
-      default:
-        //
-        break;
+    pRequest = (groupRequest *)ellNext(&pRequest->node);
+  }
+  if (!pRequest) {
+    pRequest = (groupRequest *)calloc(1, sizeof(groupRequest));
+    if (pRequest) {
+      pRequest->group = group;
+      pRequest->trigger = trigger;
+      ellAdd(&groupQueue, &pRequest->node);
     }
-    
-    //
-    setIntegerParam(ADStatus, ADStatusWaiting);
-    callParamCallbacks();
-    
-    } else {
-    printf("Ignoring set rec ready\n");
   }
+  epicsMutexUnlock(groupMutex);
+  epicsEventSignal(groupEventId);
+}
+
+
+/** The group controller thread. Runs the queued GroupArm and GroupTrigger 
+  * requests of all cameras, one at a time, without holding any camera's 
+  * lock. The thread serves every camera, so it has no driver argument. */
+static void PhotronGroupTaskC(void * /* drvPvt */) {
+  groupRequest *pRequest;
   
-  return status;
+  while (1) {
+    epicsEventWait(groupEventId);
+    while (1) {
+      epicsMutexLock(groupMutex);
+      pRequest = (groupRequest *)ellGet(&groupQueue);
+      epicsMutexUnlock(groupMutex);
+      if (!pRequest) {
+        break;
+      }
+      Photron::syncGroup(pRequest->group, pRequest->trigger);
+      free(pRequest);
+    }
+  }
 }
 
 
-asynStatus Photron::setEndless() {
-  asynStatus status = asynSuccess;
+static void PhotronArmTaskC(void *drvPvt) {
+  groupArmJob *pJob = (groupArmJob *)drvPvt;
+  pJob->status = pJob->pCamera->armForGroup();
+  epicsEventSignal(pJob->doneEventId);
+}
+
+/** Puts the camera in record mode, if it isn't already, and waits until the
+  * camera reports that it is ready to be triggered. The status is read from
+  * the camera, not from PhotronStatus, which is only updated by the other 
+  * threads now and then. Called by the group controller in a thread per 
+  * camera, so the cameras of a group are armed in parallel. Returns 
+  * asynTimeout if the camera isn't ready after GROUP_ARM_TIMEOUT. */
+asynStatus Photron::armForGroup() {
   int acqMode;
-  unsigned long nRet, nErrorCode;
-  static const char *functionName = "setEndless";
+  unsigned long nRet, nErrorCode, phostat;
+  epicsTimeStamp startTime, now;
   
-  status = getIntegerParam(PhotronAcquireMode, &acqMode);
+  this->lock();
+  getIntegerParam(PhotronAcquireMode, &acqMode);
+  if (acqMode != 1) {
+    // Same as setting AcquireMode to Record
+    setIntegerParam(PhotronAcquireMode, 1);
+    setRecReady();
+    epicsEventSignal(this->startRecEventId);
+    callParamCallbacks();
+  }
+  this->unlock();
+  
+  epicsTimeGetCurrent(&startTime);
+  while (1) {
+    // armBusy keeps the device open during the call
+    this->lock();
+    if (!this->cameraConnected || this->linkLost) {
+      this->unlock();
+      printf("%s:armForGroup: camera %s is disconnected\n", driverName, 
+             this->portName);
+      return asynError;
+    }
+    this->armBusy = 1;
+    this->unlock();
+    nRet = PDC_GetStatus(this->nDeviceNo, &phostat, &nErrorCode);
+    this->lock();
+    this->armBusy = 0;
+    epicsEventSignal(this->armIdleEventId);
+    if (nRet == PDC_FAILED) {
+      checkLinkError(nErrorCode);
+    }
+    this->unlock();
+    if (nRet == PDC_FAILED) {
+      printf("%s:armForGroup: PDC_GetStatus failed for camera %s. error = %d\n", 
+             driverName, this->portName, nErrorCode);
+      return asynError;
+    }
+    if ((phostat == PDC_STATUS_RECREADY) || (phostat == PDC_STATUS_ENDLESS)) {
+      return asynSuccess;
+    }
+    
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &startTime) > GROUP_ARM_TIMEOUT) {
+      printf("%s:armForGroup: camera %s didn't arm; status = %d\n", 
+             driverName, this->portName, phostat);
+      return asynTimeout;
+    }
+    epicsThreadSleep(GROUP_ARM_POLL);
+  }
+}
+
+
+/** Arms the cameras of a sync group in parallel and, if requested, triggers 
+  * them back-to-back once every camera is ready. The triggers are sent 
+  * without holding any camera's lock, so that nothing delays them. The 
+  * result, the arming time and the time between the first and last trigger
+  * are reported by every camera of the group, and GroupArm and GroupTrigger
+  * are reset. Runs in the group controller thread.
+  * \param[in] group The sync group
+  * \param[in] trigger Send software triggers after arming
+  */
+void Photron::syncGroup(int group, int trigger) {
+  cameraNode *pNode;
+  Photron **pMembers;
+  groupArmJob *pJobs;
+  epicsTimeStamp startTime, armTime, firstTrig, lastTrig;
+  unsigned long nRet, nErrorCode;
+  int numMembers, index, memberGroup;
+  int armed = 1;
+  int result = GROUP_STATUS_ARMED;
+  double armMs, skewUs = 0.0;
+  
+  pMembers = (Photron **)calloc(ellCount(cameraList), sizeof(Photron *));
+  pJobs = (groupArmJob *)calloc(ellCount(cameraList), sizeof(groupArmJob));
+  if (!pMembers || !pJobs) {
+    free(pMembers);
+    free(pJobs);
+    return;
+  }
+  
+  // Find the cameras of the group
+  numMembers = 0;
+  pNode = (cameraNode *)ellFirst(cameraList);
+  while (pNode) {
+    pNode->pCamera->lock();
+    pNode->pCamera->getIntegerParam(pNode->pCamera->PhotronSyncGroup, &memberGroup);
+    if (memberGroup == group) {
+      pMembers[numMembers++] = pNode->pCamera;
+      pNode->pCamera->setIntegerParam(pNode->pCamera->PhotronGroupStatus, 
+                                      GROUP_STATUS_ARMING);
+      pNode->pCamera->callParamCallbacks();
+    }
+    pNode->pCamera->unlock();
+    pNode = (cameraNode *)ellNext(&pNode->node);
+  }
+  
+  // Arm them in parallel
+  epicsTimeGetCurrent(&startTime);
+  for (index=0; index<numMembers; index++) {
+    pJobs[index].pCamera = pMembers[index];
+    pJobs[index].status = asynError;
+    pJobs[index].doneEventId = epicsEventCreate(epicsEventEmpty);
+    if (!pJobs[index].doneEventId || 
+        (epicsThreadCreate("PhotronArmTask", epicsThreadPriorityHigh,
+                           epicsThreadGetStackSize(epicsThreadStackMedium),
+                           (EPICSTHREADFUNC)PhotronArmTaskC, &pJobs[index]) == NULL)) {
+      printf("%s:syncGroup: can't start arming camera %s\n", driverName, 
+             pMembers[index]->portName);
+      if (pJobs[index].doneEventId) {
+        epicsEventSignal(pJobs[index].doneEventId);
+      }
+    }
+  }
+  for (index=0; index<numMembers; index++) {
+    if (pJobs[index].doneEventId) {
+      epicsEventWait(pJobs[index].doneEventId);
+      epicsEventDestroy(pJobs[index].doneEventId);
+    }
+    if (pJobs[index].status == asynTimeout) {
+      armed = 0;
+      if (result != GROUP_STATUS_ERROR) {
+        result = GROUP_STATUS_TIMEOUT;
+      }
+    } else if (pJobs[index].status != asynSuccess) {
+      armed = 0;
+      result = GROUP_STATUS_ERROR;
+    }
+  }
+  epicsTimeGetCurrent(&armTime);
+  armMs = 1000.0 * epicsTimeDiffInSeconds(&armTime, &startTime);
+  
+  // Trigger them back-to-back
+  if (trigger && armed) {
+    // Same state as an Acquire in record mode. Acquire is set before the 
+    // trigger, so that the record task can't finish the recording and reset
+    // it first.
+    for (index=0; index<numMembers; index++) {
+      pMembers[index]->lock();
+      pMembers[index]->setIntegerParam(pMembers[index]->ADAcquire, 1);
+      pMembers[index]->callParamCallbacks();
+      pMembers[index]->unlock();
+    }
+    result = GROUP_STATUS_TRIGGERED;
+    for (index=0; index<numMembers; index++) {
+      nRet = PDC_TriggerIn(pMembers[index]->nDeviceNo, &nErrorCode);
+      epicsTimeGetCurrent(&lastTrig);
+      if (index == 0) {
+        firstTrig = lastTrig;
+      }
+      pJobs[index].status = asynSuccess;
+      if (nRet == PDC_FAILED) {
+        printf("PDC_TriggerIn failed. error = %d\n", nErrorCode);
+        pJobs[index].status = asynError;
+        result = GROUP_STATUS_ERROR;
+      }
+    }
+    if (numMembers > 0) {
+      skewUs = 1.e6 * epicsTimeDiffInSeconds(&lastTrig, &firstTrig);
+    }
+  } else if (trigger) {
+    printf("%s:syncGroup: not all cameras of group %d armed; not triggering\n", 
+           driverName, group);
+  }
+  
+  // Report the result
+  for (index=0; index<numMembers; index++) {
+    pMembers[index]->lock();
+    if (trigger && armed) {
+      if (pJobs[index].status != asynSuccess) {
+        pMembers[index]->setIntegerParam(pMembers[index]->ADAcquire, 0);
+      }
+      pMembers[index]->setDoubleParam(pMembers[index]->PhotronGroupTrigSkew, skewUs);
+    }
+    pMembers[index]->setDoubleParam(pMembers[index]->PhotronGroupArmTime, armMs);
+    pMembers[index]->setIntegerParam(pMembers[index]->PhotronGroupStatus, result);
+    pMembers[index]->setIntegerParam(pMembers[index]->PhotronGroupArm, 0);
+    pMembers[index]->setIntegerParam(pMembers[index]->PhotronGroupTrigger, 0);
+    pMembers[index]->callParamCallbacks();
+    pMembers[index]->unlock();
+  }
+  
+  free(pMembers);
+  free(pJobs);
+}
+
+
+asynStatus Photron::setRecReady() {
+  asynStatus status = asynSuccess;
+  int acqMode, mode, apiMode;
+  unsigned long nRet, nErrorCode;
+  static const char *functionName = "setRecReady";
+  
+  status = getIntegerParam(PhotronAcquireMode, &acqMode);
+  
+  // Only set rec ready if in record mode
+  if (acqMode == 1) {
+    nRet = PDC_SetRecReady(nDeviceNo, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_SetRecReady failed. error = %d\n", nErrorCode);
+      return asynError;
+    }
+    
+    // This code is duplicated in setTriggerMode
+    getIntegerParam(ADTriggerMode, &mode);
+    
+    // The mode isn't in the right format for the PDC_SetTriggerMode call
+    apiMode = this->trigModeToAPI(mode);
+    
+    // Set endless for trigger modes that need it
+    switch (apiMode) {
+      case PDC_TRIGGER_CENTER:
+      case PDC_TRIGGER_END:
+      case PDC_TRIGGER_MANUAL:
+      // Setting endless mode for random modes generates an extra recording
+      // but only if fewer than the specified number of recordings are generated
+      case PDC_TRIGGER_RANDOM_CENTER:
+      case PDC_TRIGGER_RANDOM_MANUAL:
+        // The SA-Z needs a delay to reliably enter endless mode
+        epicsThreadSleep(0.5);
+        setEndless();
+        break;
+      default:
+        //
+        break;
+    }
+    
+    //
+    setIntegerParam(ADStatus, ADStatusWaiting);
+    callParamCallbacks();
+    
+    } else {
+    printf("Ignoring set rec ready\n");
+  }
+  
+  return status;
+}
+
+
+asynStatus Photron::setEndless() {
+  asynStatus status = asynSuccess;
+  int acqMode;
+  unsigned long nRet, nErrorCode;
+  static const char *functionName = "setEndless";
+  
+  status = getIntegerParam(PhotronAcquireMode, &acqMode);
   
   // Only set endless trigger if in record mode
   // TODO: add test for relevent trigger modes
@@ -2433,6 +5126,8 @@ asynStatus Photron::setIRIG(epicsInt32 value) {
       //   time to execute PDC_SetIRIG = 40.57 msec
       // TODO: make the following printf an optional asyn trace message
       printf("IRIG clock correlation uncertainty: %d seconds and %d nanoseconds\n", secDiff, nsecDiff);
+      // The camera's clock restarted, so the old model no longer applies
+      resetIRIGModel();
     } else {
       nRet = PDC_SetIRIG(this->nDeviceNo, PDC_FUNCTION_OFF, &nErrorCode);
     }
@@ -2620,6 +5315,7 @@ asynStatus Photron::readMem() {
   unsigned long nRet, nErrorCode;
   PDC_FRAME_INFO FrameInfo;
   unsigned long memRate, memWidth, memHeight;
+  int head;
   unsigned long memTrigMode, memAFrames, memRFrames, memRCount;
   unsigned long tMode;
   PDC_IRIG_INFO tDataStart, tDataEnd;
@@ -2642,6 +5338,10 @@ asynStatus Photron::readMem() {
   // AND status is playback
   if (acqMode == 1) {
     if (phostat == PDC_STATUS_PLAYBACK) {
+      // Cached frames and saved ranges belong to the previous recording
+      previewCacheClear();
+      clearSaveRanges();
+      
       // Retrieves frame information 
       nRet = PDC_GetMemFrameInfo(this->nDeviceNo, this->nChildNo, &FrameInfo,
                                  &nErrorCode);
@@ -2680,6 +5380,21 @@ asynStatus Photron::readMem() {
       printf("Memory Resolution: %d x %d\n", memWidth, memHeight);
       this->memWidth = memWidth;
       this->memHeight = memHeight;
+      this->headMemWidth[0] = memWidth;
+      this->headMemHeight[0] = memHeight;
+      
+      // The other heads can record with their own resolution
+      for (head=1; head<this->numHeads; head++) {
+        nRet = PDC_GetMemResolution(this->nDeviceNo, this->headChildNo[head], 
+                                    &memWidth, &memHeight, &nErrorCode);
+        if (nRet == PDC_FAILED) {
+          printf("PDC_GetMemResolution Error %d; head = %d\n", nErrorCode, 
+                 head+1);
+          return asynError;
+        }
+        this->headMemWidth[head] = memWidth;
+        this->headMemHeight[head] = memHeight;
+      }
       
       // PDC_GetMemRecordRate
       nRet = PDC_GetMemRecordRate(this->nDeviceNo, this->nChildNo, &memRate,
@@ -2704,6 +5419,9 @@ asynStatus Photron::readMem() {
       printf("Memory Random Frames = %d\n", memRFrames);
       printf("Memory Record Count = %d\n", memRCount);
       
+      // Find the recordings of the random trigger modes
+      findRecordings(memTrigMode, memAFrames, memRFrames, memRCount);
+      
       // PDC_GetMemIRIG
       nRet = PDC_GetMemIRIG(this->nDeviceNo, this->nChildNo, &tMode, &nErrorCode);
       if (nRet == PDC_FAILED) {
@@ -2740,6 +5458,8 @@ asynStatus Photron::readMem() {
       
       }
       
+      // Read the per-frame exposure and MCDL data for the whole recording
+      readFrameData();
       
     } else {
       printf("status != playback; Ignoring read mem\n");
@@ -2754,121 +5474,1206 @@ asynStatus Photron::readMem() {
 }
 
 
-asynStatus Photron::setPreviewRange(epicsInt32 function, epicsInt32 value) {
-  asynStatus status = asynSuccess;
-  epicsInt32 index;
-  epicsInt32 start, end, frameStart, frameEnd;
-  static const char *functionName = "setPreviewRange";
+/** Reads the per-frame exposure times and MCDL data of the recording in 
+  * memory, if the camera supports them, so that they can be attached to the 
+  * images as attributes without an SDK call per frame. The MCDL data is read
+  * in chunks of frames. Must be called after readMem has read the frame info.
+  */
+asynStatus Photron::readFrameData() {
+  unsigned long nRet, nErrorCode;
+  unsigned long mcdlMode;
+  long frame, numFrames, index;
+  PDC_IRIGMCDL_INFO *pChunk;
+  static const char *functionName = "readFrameData";
   
-  // Note: value isn't currently used here, so it should probably be removed
+  releaseFrameData();
   
-  getIntegerParam(PhotronPMIndex, &index);
-  getIntegerParam(PhotronPMStart, &start);
-  getIntegerParam(PhotronPMEnd, &end);
-  getIntegerParam(PhotronFrameStart, &frameStart);
-  getIntegerParam(PhotronFrameEnd, &frameEnd);
+  this->frameDataStart = this->FrameInfo.m_nStart;
+  this->frameDataCount = this->FrameInfo.m_nEnd - this->FrameInfo.m_nStart + 1;
+  if (this->frameDataCount <= 0) {
+    this->frameDataCount = 0;
+    return asynSuccess;
+  }
   
-  if (function == PhotronPMStart) {
-    printf("PhotronPMStart: value = %d\n", value);
-    // Correct the starting value, if necessary
-    if (start > end) {
-      start = end;
-    }
-    if (start < frameStart) {
-      start = frameStart;
-    }
-    setIntegerParam(PhotronPMStart, start);
-    // Correct the current index, if necessary
-    if (index < start) {
-      index = start;
-    }
-    setIntegerParam(PhotronPMIndex, index);
-  } else if (function == PhotronPMEnd) {
-    printf("PhotronPMEnd: value = %d\n", value);
-    // Correct the ending value, if necessary
-    if (end < start) {
-      end = start;
+  // Exposure time of each frame
+  if (this->functionList[PDC_EXIST_EXPOSETIME_DATA] == PDC_EXIST_SUPPORTED) {
+    this->exposeData = (UINT32 *)calloc(this->frameDataCount, sizeof(UINT32));
+    if (this->exposeData) {
+      this->exposeDataCount = this->frameDataCount;
+      nRet = PDC_GetExposeTimeData(this->nDeviceNo, this->nChildNo, 
+                                   this->exposeData, &(this->exposeDataCount), 
+                                   &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetExposeTimeData Error %d\n", nErrorCode);
+        free(this->exposeData);
+        this->exposeData = NULL;
+        this->exposeDataCount = 0;
+      }
     }
-    if (end > frameEnd) {
-      end = frameEnd;
+  }
+  
+  // MCDL analog and digital channels of each frame
+  if (this->functionList[PDC_EXIST_MCDL] == PDC_EXIST_SUPPORTED) {
+    nRet = PDC_GetMemMCDL(this->nDeviceNo, this->nChildNo, &mcdlMode, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetMemMCDL Error %d\n", nErrorCode);
+      mcdlMode = PDC_FUNCTION_OFF;
     }
-    setIntegerParam(PhotronPMEnd, end);
-    // Correct the current index, if necessary
-    if (index > end) {
-      index = end;
+    
+    if (mcdlMode == PDC_FUNCTION_ON) {
+      this->mcdlData = (PDC_MCDL_INFO *)calloc(this->frameDataCount, sizeof(PDC_MCDL_INFO));
+      pChunk = (PDC_IRIGMCDL_INFO *)calloc(MCDL_CHUNK_FRAMES, sizeof(PDC_IRIGMCDL_INFO));
+      if (!this->mcdlData || !pChunk) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: error allocating MCDL buffers\n", driverName, functionName);
+        free(pChunk);
+        free(this->mcdlData);
+        this->mcdlData = NULL;
+        return asynError;
+      }
+      
+      for (frame=0; frame<this->frameDataCount; frame+=MCDL_CHUNK_FRAMES) {
+        numFrames = this->frameDataCount - frame;
+        if (numFrames > MCDL_CHUNK_FRAMES) {
+          numFrames = MCDL_CHUNK_FRAMES;
+        }
+        nRet = PDC_GetMemIRIGandMCDLData(this->nDeviceNo, this->nChildNo, 
+                                         this->frameDataStart + frame, numFrames,
+                                         pChunk, &nErrorCode);
+        if (nRet == PDC_FAILED) {
+          printf("PDC_GetMemIRIGandMCDLData Error %d; frame = %d\n", nErrorCode, 
+                 (int)(this->frameDataStart + frame));
+          free(this->mcdlData);
+          this->mcdlData = NULL;
+          break;
+        }
+        for (index=0; index<numFrames; index++) {
+          this->mcdlData[frame + index] = pChunk[index].m_MCDLInfo;
+        }
+      }
+      free(pChunk);
     }
-    setIntegerParam(PhotronPMIndex, index);
   }
   
   return asynSuccess;
 }
 
 
-asynStatus Photron::setPMIndex(epicsInt32 value) {
-  int status = asynSuccess;
-  int start, end;
-  static const char *functionName = "setPMIndex";
+/** Chooses the time to which the frame times of the recording in memory are
+  * anchored. In order of preference this is the user-supplied time of the 
+  * trigger frame, the time at which PhotronRecTask first saw the camera 
+  * recording (the trigger frame), or the time at which the camera returned to
+  * live (the end frame). The user-supplied time is not cleared after use, so it
+  * applies to every readout until it is changed or set to 0. Must be called
+  * after readMem.
+  */
+void Photron::setFrameTimeAnchor() {
+  double trigTime;
+  int source, index;
+  unsigned long nRet, nErrorCode;
+  PDC_IRIG_INFO tData;
+  static const char *functionName = "setFrameTimeAnchor";
   
-  status |= getIntegerParam(PhotronPMStart, &start);
-  status |= getIntegerParam(PhotronPMEnd, &end);
+  getDoubleParam(PhotronTrigTime, &trigTime);
   
-  if (value < start) {
-    value = start;
-  }
-  if (value > end) {
-    value = end;
+  if (trigTime > 0.0) {
+    this->frameAnchorTime.secPastEpoch = (epicsUInt32)trigTime;
+    this->frameAnchorTime.nsec = (epicsUInt32)((trigTime - floor(trigTime)) * 1.e9);
+    this->frameAnchorFrame = this->FrameInfo.m_nTrigger;
+    source = FRAME_TIME_USER;
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: trigger frame %ld anchored to TrigTime %f\n",
+              driverName, functionName, this->frameAnchorFrame, trigTime);
+  } else if (this->recStartValid) {
+    this->frameAnchorTime = this->recStartTime;
+    this->frameAnchorFrame = this->FrameInfo.m_nTrigger;
+    source = FRAME_TIME_REC_START;
+  } else {
+    this->frameAnchorTime = this->recEndTime;
+    this->frameAnchorFrame = this->FrameInfo.m_nEnd;
+    source = FRAME_TIME_REC_END;
   }
-  status |= setIntegerParam(PhotronPMIndex, value);
   
-  status |= this->readMemImage(value);
+  setIntegerParam(PhotronFrameTimeSource, source);
   
-  return (asynStatus)status;
+  // Time of the event frame of each recording
+  for (index=0; index<this->numRecordings; index++) {
+    nRet = PDC_FAILED;
+    if (this->tMode == 1) {
+      memset(&tData, 0, sizeof(tData));
+      nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, 
+                                this->recordingEvent[index], &tData, &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+      }
+    }
+    // Fall back to the frame time model if there is no IRIG time
+    if (nRet != PDC_FAILED) {
+      this->timeDataToTimeStamp(&tData, &(this->recordingTrigTime[index]));
+    } else {
+      this->frameTimeToTimeStamp(this->recordingEvent[index], 
+                                 &(this->recordingTrigTime[index]));
+    }
+  }
+  
+  callParamCallbacks();
 }
 
 
-asynStatus Photron::changePMIndex(epicsInt32 value) {
-  int status = asynSuccess;
-  epicsInt32 index;
-  static const char *functionName = "changePMIndex";
+/** Works out the boundaries of the recordings in memory for the random 
+  * trigger modes, which store up to PhotronRecCount recordings of 
+  * PhotronRandomFrames frames each. Each recording is placed around its event
+  * frame according to the trigger mode. Other trigger modes have a single 
+  * recording and numRecordings is set to 0.
+  */
+void Photron::findRecordings(unsigned long memTrigMode, unsigned long memAFrames,
+                             unsigned long memRFrames, unsigned long memRCount) {
+  long before, event;
+  unsigned long index, first, count;
   
-  // check for playback mode?
+  this->numRecordings = 0;
   
-  status |= getIntegerParam(PhotronPMIndex, &index);
+  switch (memTrigMode) {
+    case PDC_TRIGGER_RANDOM:
+      before = 0;
+      break;
+    case PDC_TRIGGER_RANDOM_CENTER:
+      before = memRFrames / 2;
+      break;
+    case PDC_TRIGGER_RANDOM_MANUAL:
+      before = (memRFrames > memAFrames) ? (memRFrames - memAFrames) : 0;
+      break;
+    default:
+      setIntegerParam(PhotronNumRecordings, 0);
+      return;
+  }
   
-  // check for valid index here?
-  if (value > 0) {
-    // Increase the preview mode index
-    index++;
-  } else {
-    // Decrease the preview mode index
-    index--;
+  count = this->FrameInfo.m_nEventCount;
+  if (count > MAX_RECORDINGS) {
+    count = MAX_RECORDINGS;
   }
   
-  // setPMIndex calls setIntegerParam, then calls readMemImage
-  // readMemImage calls callParamCallbacks
-  status |= this->setPMIndex(index);
+  // Endless mode generates an extra first recording when fewer than the 
+  // specified number of recordings were triggered
+  first = 0;
+  if ((memTrigMode != PDC_TRIGGER_RANDOM) && (count > 1) && (count < memRCount)) {
+    first = 1;
+  }
   
-  return (asynStatus)status;
+  for (index=first; index<count; index++) {
+    event = this->FrameInfo.m_nEvent[index];
+    this->recordingEvent[this->numRecordings] = event;
+    this->recordingStart[this->numRecordings] = event - before;
+    this->recordingEnd[this->numRecordings] = event - before + (long)memRFrames - 1;
+    if (this->recordingStart[this->numRecordings] < this->FrameInfo.m_nStart) {
+      this->recordingStart[this->numRecordings] = this->FrameInfo.m_nStart;
+    }
+    if (this->recordingEnd[this->numRecordings] > this->FrameInfo.m_nEnd) {
+      this->recordingEnd[this->numRecordings] = this->FrameInfo.m_nEnd;
+    }
+    printf("Recording %d: frames %ld to %ld, event frame %ld\n", this->numRecordings,
+           this->recordingStart[this->numRecordings], 
+           this->recordingEnd[this->numRecordings], event);
+    this->numRecordings++;
+  }
+  
+  setIntegerParam(PhotronNumRecordings, this->numRecordings);
 }
 
 
-// This is called during playback (preview) mode
-// value has already been validated
-asynStatus Photron::readMemImage(epicsInt32 value) {
-  asynStatus status = asynSuccess;
-  int transferBitDepth;
-  unsigned long nRet, nErrorCode;
-  PDC_IRIG_INFO tData;
-  double tRel, tStart, tNow;
-  //
-  NDArray *pImage;
-  NDArrayInfo_t arrayInfo;
-  int colorMode = NDColorModeMono;
-  //
-  void *pBuf;  /* Memory sequence pointer for storing a live image */
-  //
-  NDDataType_t dataType;
-  int pixelSize;
+/** Returns the index of the recording that holds a frame, or -1 if the 
+  * frame isn't part of a recording found by findRecordings */
+int Photron::frameRecording(long frameNo) {
+  int index;
+  
+  for (index=0; index<this->numRecordings; index++) {
+    if ((frameNo >= this->recordingStart[index]) && 
+        (frameNo <= this->recordingEnd[index])) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+
+/** Converts a frame number of the recording in memory to an EPICS time stamp
+  * using the anchor from setFrameTimeAnchor and the record rate. */
+void Photron::frameTimeToTimeStamp(long frameNo, epicsTimeStamp *pTimeStamp) {
+  *pTimeStamp = this->frameAnchorTime;
+  if (this->memRate > 0) {
+    epicsTimeAddSeconds(pTimeStamp, 
+                        (double)(frameNo - this->frameAnchorFrame) / this->memRate);
+  }
+}
+
+
+/** Finds a frame in the preview cache without marking it as used.
+  * Returns NULL if the frame isn't cached. */
+previewCacheEntry *Photron::previewCacheFind(long frameNo, size_t size) {
+  previewCacheEntry *pEntry;
+  
+  pEntry = (previewCacheEntry *)ellFirst(&(this->previewCache));
+  while (pEntry) {
+    if ((pEntry->frameNo == frameNo) && (pEntry->size == size)) {
+      return pEntry;
+    }
+    pEntry = (previewCacheEntry *)ellNext(&(pEntry->node));
+  }
+  return NULL;
+}
+
+
+/** Copies a frame and its IRIG data from the preview cache and marks it as
+  * the most recently used frame.
+  * Returns 1 if the frame was cached, 0 otherwise. */
+int Photron::previewCacheGet(long frameNo, void *pData, size_t size, 
+                             PDC_IRIG_INFO *pTData) {
+  previewCacheEntry *pEntry;
+  
+  pEntry = previewCacheFind(frameNo, size);
+  if (!pEntry) {
+    this->previewCacheMisses++;
+    return 0;
+  }
+  
+  memcpy(pData, pEntry->pData, size);
+  *pTData = pEntry->tData;
+  
+  // Move the frame to the front of the list
+  ellDelete(&(this->previewCache), &(pEntry->node));
+  ellInsert(&(this->previewCache), NULL, &(pEntry->node));
+  
+  this->previewCacheHits++;
+  return 1;
+}
+
+
+/** Adds a frame and its IRIG data to the preview cache, evicting the least
+  * recently used frames to stay within PMCacheBudget. */
+void Photron::previewCachePut(long frameNo, const void *pData, size_t size, 
+                              PDC_IRIG_INFO *pTData) {
+  previewCacheEntry *pEntry;
+  int budget;
+  size_t maxBytes;
+  
+  getIntegerParam(PhotronPMCacheBudget, &budget);
+  maxBytes = (size_t)budget * 1024 * 1024;
+  if (size > maxBytes) {
+    return;
+  }
+  
+  pEntry = previewCacheFind(frameNo, size);
+  if (pEntry) {
+    return;
+  }
+  
+  previewCacheTrim(maxBytes - size);
+  
+  pEntry = (previewCacheEntry *)calloc(1, sizeof(previewCacheEntry));
+  if (!pEntry) {
+    return;
+  }
+  pEntry->pData = photronFrameMalloc(size);
+  if (!pEntry->pData) {
+    free(pEntry);
+    return;
+  }
+  
+  memcpy(pEntry->pData, pData, size);
+  pEntry->frameNo = frameNo;
+  pEntry->size = size;
+  pEntry->tData = *pTData;
+  
+  ellInsert(&(this->previewCache), NULL, &(pEntry->node));
+  this->previewCacheBytes += size;
+}
+
+
+/** Evicts the least recently used frames until the cache uses no more than
+  * maxBytes. */
+void Photron::previewCacheTrim(size_t maxBytes) {
+  previewCacheEntry *pEntry;
+  
+  while (this->previewCacheBytes > maxBytes) {
+    pEntry = (previewCacheEntry *)ellLast(&(this->previewCache));
+    if (!pEntry) {
+      break;
+    }
+    ellDelete(&(this->previewCache), &(pEntry->node));
+    this->previewCacheBytes -= pEntry->size;
+    photronFrameFree(pEntry->pData);
+    free(pEntry);
+  }
+}
+
+
+/** Empties the preview cache and resets its statistics */
+void Photron::previewCacheClear() {
+  previewCacheTrim(0);
+  this->previewCacheBytes = 0;
+  this->previewCacheHits = 0;
+  this->previewCacheMisses = 0;
+  updatePreviewCacheParams();
+}
+
+
+void Photron::updatePreviewCacheParams() {
+  unsigned long total;
+  
+  total = this->previewCacheHits + this->previewCacheMisses;
+  setDoubleParam(PhotronPMCacheUsed, this->previewCacheBytes / (1024.0 * 1024.0));
+  setDoubleParam(PhotronPMCacheHitRate, 
+                 (total > 0) ? (100.0 * this->previewCacheHits / total) : 0.0);
+}
+
+
+/** Finds the correction references of a resolution. If create is set, an 
+  * empty entry is added if there isn't one. */
+correctionRef *Photron::findCorrectionRef(int width, int height, int create) {
+  correctionRef *pRef;
+  
+  for (pRef = (correctionRef *)ellFirst(&(this->correctionRefs)); pRef;
+       pRef = (correctionRef *)ellNext(&(pRef->node))) {
+    if ((pRef->width == width) && (pRef->height == height)) {
+      return pRef;
+    }
+  }
+  
+  if (create) {
+    pRef = (correctionRef *)calloc(1, sizeof(correctionRef));
+    if (pRef) {
+      pRef->width = width;
+      pRef->height = height;
+      epicsMutexLock(this->corrMutex);
+      ellAdd(&(this->correctionRefs), &(pRef->node));
+      epicsMutexUnlock(this->corrMutex);
+    }
+  }
+  return pRef;
+}
+
+
+/** Captures a dark or flat reference for the current resolution by averaging
+  * CorrFrames live images. The camera must be in live mode and not 
+  * acquiring. A flat reference needs a dark reference, which is subtracted 
+  * from it; the gain of each pixel scales it to the mean of the flat. Runs 
+  * in PhotronCaptureTask with the lock held, which is released during the 
+  * transfers and between the frames; starting an acquisition stops it. */
+asynStatus Photron::captureCorrectionRef(int flat) {
+  asynStatus status = asynSuccess;
+  int acquire, acqMode, numFrames, frame, pixelGain;
+  size_t numPixels, i;
+  epicsUInt32 *pSum;
+  epicsUInt16 *pRef, *pData;
+  double mean, value;
+  NDArray *pImage;
+  correctionRef *pEntry;
+  int sizeX, sizeY;
+  static const char *functionName = "captureCorrectionRef";
+  
+  getIntegerParam(ADAcquire, &acquire);
+  getIntegerParam(PhotronAcquireMode, &acqMode);
+  if (acquire || (acqMode != 0)) {
+    printf("%s:%s: references are captured in live mode while not acquiring\n",
+           driverName, functionName);
+    return asynError;
+  }
+  if (this->pixelBits == 8) {
+    printf("%s:%s: references need 16-bit transfers\n", driverName, 
+           functionName);
+    return asynError;
+  }
+  
+  getIntegerParam(ADSizeX, &sizeX);
+  getIntegerParam(ADSizeY, &sizeY);
+  getIntegerParam(PhotronCorrFrames, &numFrames);
+  getIntegerParam(PhotronPixelGainCorr, &pixelGain);
+  if (numFrames < 1) {
+    numFrames = 1;
+  }
+  
+  pEntry = findCorrectionRef(sizeX, sizeY, flat ? 0 : 1);
+  if (!pEntry || (flat && !pEntry->pDark)) {
+    printf("%s:%s: capture a dark reference for %dx%d first\n", driverName, 
+           functionName, sizeX, sizeY);
+    return asynError;
+  }
+  
+  numPixels = (size_t)sizeX * sizeY;
+  pSum = (epicsUInt32 *)calloc(numPixels, sizeof(epicsUInt32));
+  pRef = (epicsUInt16 *)malloc(numPixels * sizeof(epicsUInt16));
+  if (!pSum || !pRef) {
+    free(pSum);
+    free(pRef);
+    return asynError;
+  }
+  
+  for (frame=0; frame<numFrames; frame++) {
+    getIntegerParam(ADAcquire, &acquire);
+    getIntegerParam(PhotronAcquireMode, &acqMode);
+    if (acquire || (acqMode != 0)) {
+      printf("%s:%s: acquisition started during the capture\n", 
+             driverName, functionName);
+      status = asynError;
+      break;
+    }
+    status = grabLiveImage(&pImage, 0);
+    if (status != asynSuccess) {
+      break;
+    }
+    // grabLiveImage releases the lock during the transfer
+    if ((pImage->dims[0].size != (size_t)sizeX) || 
+        (pImage->dims[1].size != (size_t)sizeY)) {
+      printf("%s:%s: the resolution changed during the capture\n", 
+             driverName, functionName);
+      pImage->release();
+      status = asynError;
+      break;
+    }
+    pData = (epicsUInt16 *)pImage->pData;
+    // The references must match the frames they will correct
+    if (pixelGain && pEntry->pPixelGain) {
+      correctU16(pData, NULL, pEntry->pPixelGain, pData, numPixels);
+    }
+    for (i=0; i<numPixels; i++) {
+      pSum[i] += pData[i];
+    }
+    pImage->release();
+    // Wait for the next frame
+    this->unlock();
+    epicsThreadSleep((this->nRate > 0) ? (1.0 / this->nRate) : 0.01);
+    this->lock();
+  }
+  
+  if (status == asynSuccess) {
+    if (!flat) {
+      for (i=0; i<numPixels; i++) {
+        pRef[i] = (epicsUInt16)((pSum[i] + numFrames / 2) / numFrames);
+      }
+      epicsMutexLock(this->corrMutex);
+      free(pEntry->pDark);
+      pEntry->pDark = pRef;
+      epicsMutexUnlock(this->corrMutex);
+      pRef = NULL;
+    } else {
+      // Dark-subtracted flat; its mean is the target of the gain
+      mean = 0.0;
+      for (i=0; i<numPixels; i++) {
+        value = (double)pSum[i] / numFrames - pEntry->pDark[i];
+        mean += (value > 0.0) ? value : 0.0;
+      }
+      mean /= numPixels;
+      for (i=0; i<numPixels; i++) {
+        value = (double)pSum[i] / numFrames - pEntry->pDark[i];
+        // Dead pixels are left uncorrected
+        value = (value > 0.0) ? (mean * CORR_GAIN_ONE / value) : CORR_GAIN_ONE;
+        pRef[i] = (epicsUInt16)((value > 65535.0) ? 65535.0 : (value + 0.5));
+      }
+      epicsMutexLock(this->corrMutex);
+      free(pEntry->pGain);
+      pEntry->pGain = pRef;
+      epicsMutexUnlock(this->corrMutex);
+      pRef = NULL;
+    }
+    printf("%s:%s: captured %s reference for %dx%d from %d frames\n", 
+           driverName, functionName, flat ? "flat" : "dark", sizeX, sizeY, 
+           numFrames);
+  }
+  
+  free(pSum);
+  free(pRef);
+  updateCorrectionParams();
+  return status;
+}
+
+
+static void PhotronCaptureTaskC(void *drvPvt) {
+  Photron *pPvt = (Photron *)drvPvt;
+  pPvt->PhotronCaptureTask();
+}
+
+
+/** This thread captures the dark and flat references requested with 
+  * CorrCaptureDark and CorrCaptureFlat, so that the port isn't held during
+  * the capture, and resets the command when the capture is done. */
+void Photron::PhotronCaptureTask() {
+  int function;
+  
+  this->lock();
+  while (1) {
+    this->unlock();
+    epicsEventWait(this->captureEventId);
+    this->lock();
+    
+    function = this->captureFunction;
+    captureCorrectionRef(function == PhotronCorrCaptureFlat);
+    this->captureBusy = 0;
+    setIntegerParam(function, 0);
+    callParamCallbacks();
+  }
+}
+
+
+/** Discards the references of all resolutions. The pixel gain tables 
+  * downloaded from the camera are kept if keepPixelGain is set. */
+void Photron::clearCorrectionRefs(int keepPixelGain) {
+  correctionRef *pRef, *pNext;
+  
+  epicsMutexLock(this->corrMutex);
+  pRef = (correctionRef *)ellFirst(&(this->correctionRefs));
+  while (pRef) {
+    pNext = (correctionRef *)ellNext(&(pRef->node));
+    free(pRef->pDark);
+    free(pRef->pGain);
+    pRef->pDark = NULL;
+    pRef->pGain = NULL;
+    if (!keepPixelGain || !pRef->pPixelGain) {
+      ellDelete(&(this->correctionRefs), &(pRef->node));
+      free(pRef->pPixelGain);
+      free(pRef);
+    }
+    pRef = pNext;
+  }
+  epicsMutexUnlock(this->corrMutex);
+  updateCorrectionParams();
+}
+
+
+/** Downloads the camera's pixel gain table for the current resolution, 
+  * unless it is already cached and reload isn't set. The SDK doesn't 
+  * document the size of the table PDC_GetPixelGainData writes, so the 
+  * buffer is sized for the full sensor and the part beyond the current 
+  * resolution is filled with PIXEL_GAIN_GUARD; a table that overwrites it 
+  * doesn't match the frames and is rejected. The scale of the gains isn't 
+  * documented either. The table is taken as one relative gain per pixel 
+  * and scaled to a mean gain of 1, so the correction only evens out the 
+  * pixels and keeps the overall brightness. */
+asynStatus Photron::loadPixelGain(int reload) {
+  unsigned long nRet, nErrorCode, mode;
+  size_t numPixels, i;
+  epicsUInt16 *pTable;
+  correctionRef *pEntry;
+  double mean, value;
+  int sizeX, sizeY;
+  size_t maxPixels;
+  static const char *functionName = "loadPixelGain";
+  
+  if (this->functionList[PDC_EXIST_PIXELGAIN] != PDC_EXIST_SUPPORTED) {
+    printf("%s:%s: the camera has no pixel gain table\n", driverName, 
+           functionName);
+    return asynError;
+  }
+  
+  getIntegerParam(ADSizeX, &sizeX);
+  getIntegerParam(ADSizeY, &sizeY);
+  pEntry = findCorrectionRef(sizeX, sizeY, 1);
+  if (!pEntry) {
+    return asynError;
+  }
+  if (pEntry->pPixelGain && !reload) {
+    return asynSuccess;
+  }
+  
+  // The in-camera correction may be off to speed up the readout; the table
+  // of the normal mode still exists
+  nRet = PDC_GetPixelGainMode(this->nDeviceNo, this->nChildNo, &mode, 
+                              &nErrorCode);
+  if (nRet == PDC_FAILED) {
+    printf("PDC_GetPixelGainMode Error %d\n", nErrorCode);
+    return asynError;
+  }
+  if (mode == PDC_PIXELGAIN_OFF) {
+    mode = PDC_PIXELGAIN_NORMAL;
+  }
+  
+  numPixels = (size_t)sizeX * sizeY;
+  maxPixels = (size_t)this->sensorWidth * this->sensorHeight;
+  if (maxPixels < numPixels) {
+    maxPixels = numPixels;
+  }
+  pTable = (epicsUInt16 *)malloc(maxPixels * sizeof(epicsUInt16));
+  if (!pTable) {
+    return asynError;
+  }
+  for (i=numPixels; i<maxPixels; i++) {
+    pTable[i] = PIXEL_GAIN_GUARD;
+  }
+  nRet = PDC_GetPixelGainData(this->nDeviceNo, this->nChildNo, mode, pTable,
+                              &nErrorCode);
+  if (nRet == PDC_FAILED) {
+    printf("PDC_GetPixelGainData Error %d\n", nErrorCode);
+    free(pTable);
+    return asynError;
+  }
+  for (i=numPixels; i<maxPixels; i++) {
+    if (pTable[i] != PIXEL_GAIN_GUARD) {
+      printf("%s:%s: the pixel gain table is larger than %dx%d\n", 
+             driverName, functionName, sizeX, sizeY);
+      free(pTable);
+      return asynError;
+    }
+  }
+  
+  mean = 0.0;
+  for (i=0; i<numPixels; i++) {
+    mean += pTable[i];
+  }
+  mean /= numPixels;
+  if (mean <= 0.0) {
+    printf("%s:%s: the pixel gain table is empty\n", driverName, functionName);
+    free(pTable);
+    return asynError;
+  }
+  for (i=0; i<numPixels; i++) {
+    value = pTable[i] * CORR_GAIN_ONE / mean;
+    pTable[i] = (epicsUInt16)((value > 65535.0) ? 65535.0 : (value + 0.5));
+  }
+  
+  epicsMutexLock(this->corrMutex);
+  free(pEntry->pPixelGain);
+  pEntry->pPixelGain = pTable;
+  epicsMutexUnlock(this->corrMutex);
+  printf("%s:%s: loaded pixel gain table for %dx%d\n", driverName, 
+         functionName, sizeX, sizeY);
+  updateCorrectionParams();
+  return asynSuccess;
+}
+
+
+void Photron::updateCorrectionParams() {
+  correctionRef *pRef;
+  int sizeX, sizeY;
+  
+  getIntegerParam(ADSizeX, &sizeX);
+  getIntegerParam(ADSizeY, &sizeY);
+  pRef = findCorrectionRef(sizeX, sizeY, 0);
+  setIntegerParam(PhotronCorrHaveDark, (pRef && pRef->pDark) ? 1 : 0);
+  setIntegerParam(PhotronCorrHaveFlat, (pRef && pRef->pGain) ? 1 : 0);
+  setIntegerParam(PhotronPixelGainLoaded, (pRef && pRef->pPixelGain) ? 1 : 0);
+}
+
+
+/** Applies the pixel gain table and then the dark and flat correction to a
+  * 16-bit frame right after it was transferred. Frames whose resolution has
+  * no references are returned unchanged. UInt16 output is corrected in 
+  * place; for Float32 output a new array is returned and the raw frame is 
+  * released. If there is no buffer for the Float32 frame, a lossless readout
+  * waits for one; otherwise the raw frame is released and NULL is returned
+  * so the caller counts it as dropped. Called with the lock held, which is 
+  * released while the frame is corrected; corrMutex keeps the references 
+  * from being replaced.
+  * \param[in] pRaw The frame
+  * \param[in,out] pStallTime Stall time of a lossless readout, otherwise NULL
+  */
+NDArray *Photron::correctFrame(NDArray *pRaw, double *pStallTime) {
+  int mode, output, pixelGain;
+  size_t numPixels, dims[2];
+  NDArray *pOut;
+  correctionRef *pRef;
+  const epicsUInt16 *pDark, *pGain, *pPixelGain;
+  epicsUInt16 *pData;
+  epicsTimeStamp startTime, endTime;
+  static const char *functionName = "correctFrame";
+  
+  getIntegerParam(PhotronCorrMode, &mode);
+  getIntegerParam(PhotronPixelGainCorr, &pixelGain);
+  if (((mode == CORR_MODE_OFF) && !pixelGain) || !pRaw || 
+      (pRaw->dataType != NDUInt16) || (pRaw->ndims != 2)) {
+    return pRaw;
+  }
+  
+  epicsTimeGetCurrent(&startTime);
+  numPixels = pRaw->dims[0].size * pRaw->dims[1].size;
+  pData = (epicsUInt16 *)pRaw->pData;
+  dims[0] = pRaw->dims[0].size;
+  dims[1] = pRaw->dims[1].size;
+  
+  while (1) {
+    pRef = findCorrectionRef((int)dims[0], (int)dims[1], 0);
+    if (!pRef) {
+      return pRaw;
+    }
+    pPixelGain = pixelGain ? pRef->pPixelGain : NULL;
+    pDark = (mode != CORR_MODE_OFF) ? pRef->pDark : NULL;
+    pGain = (pDark && (mode == CORR_MODE_DARK_FLAT)) ? pRef->pGain : NULL;
+    if (!pPixelGain && !pDark) {
+      return pRaw;
+    }
+    
+    getIntegerParam(PhotronCorrOutput, &output);
+    pOut = pRaw;
+    if (!pDark || (output != CORR_OUTPUT_FLOAT32)) {
+      break;
+    }
+    pOut = allocOutputArray(pRaw, 2, dims, NDFloat32);
+    if (pOut) {
+      break;
+    }
+    if (!pStallTime || (this->abortFlag == 1)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error allocating buffer; frame dropped\n", 
+                driverName, functionName);
+      pRaw->release();
+      return NULL;
+    }
+    // Lossless readout; wait for the plugins to free a buffer. The lock is
+    // released, so the references are looked up again.
+    this->waitForReadoutBuffer(pStallTime, 1);
+  }
+  
+  epicsMutexLock(this->corrMutex);
+  this->unlock();
+  
+  if (pPixelGain) {
+    correctU16(pData, NULL, pPixelGain, pData, numPixels);
+  }
+  
+  if (pOut != pRaw) {
+    if (getSimdLevel() >= SIMD_AVX2) {
+      correctF32AVX2(pData, pDark, pGain, (epicsFloat32 *)pOut->pData, 
+                     numPixels);
+    } else {
+      correctF32Scalar(pData, pDark, pGain, (epicsFloat32 *)pOut->pData,
+                       numPixels);
+    }
+    pOut->uniqueId = pRaw->uniqueId;
+    pOut->timeStamp = pRaw->timeStamp;
+    pOut->epicsTS = pRaw->epicsTS;
+    pRaw->pAttributeList->copy(pOut->pAttributeList);
+    pRaw->release();
+  } else if (pDark) {
+    correctU16(pData, pDark, pGain, pData, numPixels);
+  }
+  
+  epicsMutexUnlock(this->corrMutex);
+  this->lock();
+  
+  epicsTimeGetCurrent(&endTime);
+  setDoubleParam(PhotronCorrTime, 
+                 1000.0 * epicsTimeDiffInSeconds(&endTime, &startTime));
+  return pOut;
+}
+
+
+/** Marks the frames of a color camera as Bayer data or, if RGB1 is 
+  * selected, replaces them with a demosaiced RGB1 array. The color mode of
+  * the returned array is put in pColorMode if it isn't NULL. Float32 frames
+  * from the correction stay in Bayer format. If there is no buffer for the
+  * RGB1 frame, a lossless readout waits for one; otherwise the raw frame is
+  * released and NULL is returned so the caller counts it as dropped. Called
+  * with the lock held, which is released during the demosaic; colorMutex 
+  * keeps the row buffer from being used by two frames at once.
+  * \param[in] pRaw The frame
+  * \param[out] pColorMode The color mode of the returned frame, or NULL
+  * \param[in,out] pStallTime Stall time of a lossless readout, otherwise NULL
+  */
+NDArray *Photron::convertColor(NDArray *pRaw, int *pColorMode, 
+                               double *pStallTime) {
+  int colorMode, width, height, bayerPattern;
+  size_t dims[3], scratchSize;
+  NDArray *pOut;
+  void *pScratch;
+  static const char *functionName = "convertColor";
+  
+  if ((this->colorType != PDC_COLORTYPE_COLOR) || !pRaw || 
+      (pRaw->ndims != 2)) {
+    return pRaw;
+  }
+  
+  width = (int)pRaw->dims[0].size;
+  height = (int)pRaw->dims[1].size;
+  getIntegerParam(NDColorMode, &colorMode);
+  pOut = NULL;
+  if ((colorMode == NDColorModeRGB1) && (width >= 2) && (height >= 2) &&
+      ((pRaw->dataType == NDUInt8) || (pRaw->dataType == NDUInt16))) {
+    dims[0] = 3;
+    dims[1] = width;
+    dims[2] = height;
+    pOut = allocOutputArray(pRaw, 3, dims, pRaw->dataType);
+    while (!pOut && pStallTime && (this->abortFlag == 0)) {
+      // Lossless readout; wait for the plugins to free a buffer
+      this->waitForReadoutBuffer(pStallTime, 1);
+      pOut = allocOutputArray(pRaw, 3, dims, pRaw->dataType);
+    }
+    
+    scratchSize = 3 * width * ((pRaw->dataType == NDUInt8) ? 1 : 2);
+    epicsMutexLock(this->colorMutex);
+    if (pOut && (scratchSize > this->colorScratchSize)) {
+      pScratch = realloc(this->colorScratch, scratchSize);
+      if (pScratch) {
+        this->colorScratch = pScratch;
+        this->colorScratchSize = scratchSize;
+      } else {
+        pOut->release();
+        pOut = NULL;
+      }
+    }
+    if (!pOut) {
+      epicsMutexUnlock(this->colorMutex);
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error allocating buffer; frame dropped\n", 
+                driverName, functionName);
+      pRaw->release();
+      return NULL;
+    }
+    
+    // The demosaic is done without the lock
+    bayerPattern = this->bayerPattern;
+    pScratch = this->colorScratch;
+    this->unlock();
+    if (pRaw->dataType == NDUInt8) {
+      demosaicBilinear((const epicsUInt8 *)pRaw->pData, 
+                       (epicsUInt8 *)pOut->pData, width, height, 
+                       bayerPattern, (epicsUInt8 *)pScratch);
+    } else {
+      demosaicBilinear((const epicsUInt16 *)pRaw->pData, 
+                       (epicsUInt16 *)pOut->pData, width, height, 
+                       bayerPattern, (epicsUInt16 *)pScratch);
+    }
+    epicsMutexUnlock(this->colorMutex);
+    this->lock();
+  }
+  
+  if (pOut) {
+    pOut->uniqueId = pRaw->uniqueId;
+    pOut->timeStamp = pRaw->timeStamp;
+    pOut->epicsTS = pRaw->epicsTS;
+    pRaw->pAttributeList->copy(pOut->pAttributeList);
+    pRaw->release();
+    colorMode = NDColorModeRGB1;
+  } else {
+    pOut = pRaw;
+    colorMode = NDColorModeBayer;
+    pOut->pAttributeList->add("BayerPattern", "Bayer pattern", NDAttrInt32, 
+                              &(this->bayerPattern));
+  }
+  pOut->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
+                            &colorMode);
+  if (pColorMode) {
+    *pColorMode = colorMode;
+  }
+  return pOut;
+}
+
+
+/** Starts a new prefetch pass around frameNo, cancelling the pass in 
+  * progress */
+void Photron::requestPrefetch(long frameNo) {
+  this->prefetchIndex = frameNo;
+  this->prefetchGeneration++;
+  epicsEventSignal(this->prefetchEventId);
+}
+
+
+/** Cancels the prefetch pass in progress and waits until the frame it is 
+  * transferring without the lock is done, so that the caller has the camera's
+  * memory to itself. Called with the lock held. */
+void Photron::waitForPrefetch() {
+  this->prefetchGeneration++;
+  while (this->prefetchBusy) {
+    this->unlock();
+    epicsEventWait(this->prefetchIdleEventId);
+    this->lock();
+  }
+}
+
+
+/** Adds the preview range (PMStart to PMEnd) to the list of ranges that are 
+  * read out when the preview is saved */
+void Photron::addSaveRange() {
+  int start, end, frames, i;
+  
+  if (this->numSaveRanges >= MAX_SAVE_RANGES) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:addSaveRange: only %d ranges can be saved\n", driverName, 
+              MAX_SAVE_RANGES);
+    return;
+  }
+  
+  getIntegerParam(PhotronPMStart, &start);
+  getIntegerParam(PhotronPMEnd, &end);
+  this->saveRangeStart[this->numSaveRanges] = start;
+  this->saveRangeEnd[this->numSaveRanges] = end;
+  this->numSaveRanges++;
+  
+  frames = 0;
+  for (i=0; i<this->numSaveRanges; i++) {
+    frames += this->saveRangeEnd[i] - this->saveRangeStart[i] + 1;
+  }
+  setIntegerParam(PhotronPMNumRanges, this->numSaveRanges);
+  setIntegerParam(PhotronPMRangeFrames, frames);
+}
+
+
+void Photron::clearSaveRanges() {
+  this->numSaveRanges = 0;
+  setIntegerParam(PhotronPMNumRanges, 0);
+  setIntegerParam(PhotronPMRangeFrames, 0);
+}
+
+
+/** Reads the playback parameters into the playback schedule */
+void Photron::buildPlaySchedule() {
+  getIntegerParam(PhotronPMStart, &(this->playStart));
+  getIntegerParam(PhotronPMEnd, &(this->playEnd));
+  getIntegerParam(PhotronPMPlayMult, &(this->playStride));
+  getIntegerParam(PhotronPMPlayFPS, &(this->playFps));
+  getIntegerParam(PhotronPMRepeat, &(this->playRepeat));
+  
+  if (this->playStride < 1) {
+    this->playStride = 1;
+  }
+  if (this->playFps < 1) {
+    this->playFps = 1;
+  }
+  this->playScheduleChanged = 0;
+}
+
+
+/** Finds the frame that follows index after the given number of playback 
+  * steps. The last frame of the range is always shown before playback 
+  * stops, wraps around or reverses direction.
+  * Returns 1 if playback is finished, 0 otherwise. */
+int Photron::advancePlaySchedule(int index, int steps, int *pNext) {
+  int edge, next;
+  
+  edge = (this->playDir > 0) ? this->playEnd : this->playStart;
+  
+  if (index == edge) {
+    if (this->playRepeat == PLAY_REPEAT_LOOP) {
+      *pNext = (this->playDir > 0) ? this->playStart : this->playEnd;
+      return 0;
+    } else if (this->playRepeat == PLAY_REPEAT_PING_PONG) {
+      this->playDir = -this->playDir;
+    } else {
+      *pNext = index;
+      return 1;
+    }
+  }
+  
+  next = index + this->playDir * this->playStride * steps;
+  if (next > this->playEnd) {
+    next = this->playEnd;
+  }
+  if (next < this->playStart) {
+    next = this->playStart;
+  }
+  *pNext = next;
+  return 0;
+}
+
+
+/** Frees the per-frame data of the previous recording */
+void Photron::releaseFrameData() {
+  free(this->mcdlData);
+  this->mcdlData = NULL;
+  free(this->exposeData);
+  this->exposeData = NULL;
+  this->exposeDataCount = 0;
+  this->frameDataCount = 0;
+}
+
+
+/** Attaches the per-frame exposure time and MCDL data read by readFrameData
+  * to an image. Every MCDL sample of the frame is attached: the first under
+  * the channel name (MCDLDigital, MCDLAnalogA, ...) and sample n under the 
+  * channel name followed by _n.
+  * \param[in] pImage The image
+  * \param[in] frameNo The frame number of the image in the camera's memory
+  */
+void Photron::addFrameAttributes(NDArray *pImage, long frameNo) {
+  long index;
+  epicsUInt32 exposeTime;
+  epicsUInt8 digital;
+  double analog;
+  const double *pAnalog[4];
+  int sample, channel;
+  char name[32], description[64];
+  double relTime;
+  double trigTime;
+  long trigFrame;
+  int recording;
+  
+  // Recordings of the random trigger modes have their own event frame
+  trigFrame = this->FrameInfo.m_nTrigger;
+  recording = frameRecording(frameNo);
+  if (recording >= 0) {
+    trigFrame = this->recordingEvent[recording];
+    trigTime = this->recordingTrigTime[recording].secPastEpoch + 
+               this->recordingTrigTime[recording].nsec / 1.e9;
+    pImage->pAttributeList->add("RecordingId", "Recording of the frame", 
+                                NDAttrInt32, &recording);
+    pImage->pAttributeList->add("TriggerTime", 
+                                "Time of the event frame of the recording", 
+                                NDAttrFloat64, &trigTime);
+  }
+  
+  // Time relative to the trigger frame
+  if (this->memRate > 0) {
+    relTime = (double)(frameNo - trigFrame) / this->memRate;
+    pImage->pAttributeList->add("TriggerRelativeTime", 
+                                "Time relative to the trigger frame (s)", 
+                                NDAttrFloat64, &relTime);
+  }
+  
+  index = frameNo - this->frameDataStart;
+  if ((index < 0) || (index >= this->frameDataCount)) {
+    return;
+  }
+  
+  if (this->exposeData && (index < (long)this->exposeDataCount)) {
+    exposeTime = this->exposeData[index];
+    pImage->pAttributeList->add("ExposeTime", "Exposure time of the frame", 
+                                NDAttrUInt32, &exposeTime);
+  }
+  
+  if (this->mcdlData) {
+    pAnalog[0] = this->mcdlData[index].m_nAnalogA;
+    pAnalog[1] = this->mcdlData[index].m_nAnalogB;
+    pAnalog[2] = this->mcdlData[index].m_nAnalogC;
+    pAnalog[3] = this->mcdlData[index].m_nAnalogD;
+    for (sample=0; sample<MCDL_SAMPLES; sample++) {
+      digital = this->mcdlData[index].m_nDigital[sample];
+      epicsSnprintf(name, sizeof(name), sample ? "MCDLDigital_%d" : 
+                    "MCDLDigital", sample);
+      epicsSnprintf(description, sizeof(description), 
+                    "MCDL digital channels, sample %d", sample);
+      pImage->pAttributeList->add(name, description, NDAttrUInt8, &digital);
+      for (channel=0; channel<4; channel++) {
+        analog = pAnalog[channel][sample];
+        epicsSnprintf(name, sizeof(name), sample ? "MCDLAnalog%c_%d" : 
+                      "MCDLAnalog%c", 'A' + channel, sample);
+        epicsSnprintf(description, sizeof(description), 
+                      "MCDL analog channel %c, sample %d", 'A' + channel, 
+                      sample);
+        pImage->pAttributeList->add(name, description, NDAttrFloat64, 
+                                    &analog);
+      }
+    }
+  }
+}
+
+
+asynStatus Photron::setPreviewRange(epicsInt32 function, epicsInt32 value) {
+  asynStatus status = asynSuccess;
+  epicsInt32 index;
+  epicsInt32 start, end, frameStart, frameEnd;
+  static const char *functionName = "setPreviewRange";
+  
+  // Note: value isn't currently used here, so it should probably be removed
+  
+  getIntegerParam(PhotronPMIndex, &index);
+  getIntegerParam(PhotronPMStart, &start);
+  getIntegerParam(PhotronPMEnd, &end);
+  getIntegerParam(PhotronFrameStart, &frameStart);
+  getIntegerParam(PhotronFrameEnd, &frameEnd);
+  
+  if (function == PhotronPMStart) {
+    printf("PhotronPMStart: value = %d\n", value);
+    // Correct the starting value, if necessary
+    if (start > end) {
+      start = end;
+    }
+    if (start < frameStart) {
+      start = frameStart;
+    }
+    setIntegerParam(PhotronPMStart, start);
+    // Correct the current index, if necessary
+    if (index < start) {
+      index = start;
+    }
+    setIntegerParam(PhotronPMIndex, index);
+  } else if (function == PhotronPMEnd) {
+    printf("PhotronPMEnd: value = %d\n", value);
+    // Correct the ending value, if necessary
+    if (end < start) {
+      end = start;
+    }
+    if (end > frameEnd) {
+      end = frameEnd;
+    }
+    setIntegerParam(PhotronPMEnd, end);
+    // Correct the current index, if necessary
+    if (index > end) {
+      index = end;
+    }
+    setIntegerParam(PhotronPMIndex, index);
+  }
+  
+  return asynSuccess;
+}
+
+
+asynStatus Photron::setPMIndex(epicsInt32 value) {
+  int status = asynSuccess;
+  int start, end;
+  static const char *functionName = "setPMIndex";
+  
+  status |= getIntegerParam(PhotronPMStart, &start);
+  status |= getIntegerParam(PhotronPMEnd, &end);
+  
+  if (value < start) {
+    value = start;
+  }
+  if (value > end) {
+    value = end;
+  }
+  status |= setIntegerParam(PhotronPMIndex, value);
+  
+  status |= this->readMemImage(value);
+  
+  // Read the neighbouring frames before they are requested
+  requestPrefetch(value);
+  
+  return (asynStatus)status;
+}
+
+
+asynStatus Photron::changePMIndex(epicsInt32 value) {
+  int status = asynSuccess;
+  epicsInt32 index;
+  static const char *functionName = "changePMIndex";
+  
+  // check for playback mode?
+  
+  status |= getIntegerParam(PhotronPMIndex, &index);
+  
+  // check for valid index here?
+  if (value > 0) {
+    // Increase the preview mode index
+    index++;
+    this->prefetchDir = 1;
+  } else {
+    // Decrease the preview mode index
+    index--;
+    this->prefetchDir = 0;
+  }
+  
+  // setPMIndex calls setIntegerParam, then calls readMemImage
+  // readMemImage calls callParamCallbacks
+  status |= this->setPMIndex(index);
+  
+  return (asynStatus)status;
+}
+
+
+// This is called during playback (preview) mode
+// value has already been validated
+asynStatus Photron::readMemImage(epicsInt32 value) {
+  asynStatus status = asynSuccess;
+  int transferBitDepth;
+  unsigned long nRet, nErrorCode;
+  PDC_IRIG_INFO tData;
+  epicsTimeStamp irigTime, frameTime;
+  //
+  NDArray *pImage;
+  NDArrayInfo_t arrayInfo;
+  int colorMode = NDColorModeMono;
+  //
+  void *pBuf;  /* Memory sequence pointer for storing a live image */
+  //
+  NDDataType_t dataType;
+  int pixelSize;
   size_t dims[2];
   size_t dataSize;
   //
@@ -2879,6 +6684,7 @@ asynStatus Photron::readMemImage(epicsInt32 value) {
   epicsTimeStamp startTime;
   //epicsUInt32 irigSeconds;
   epicsInt32 start;
+  int cacheFrame;
   //
   static const char *functionName = "readMemImage";
   
@@ -2897,309 +6703,1132 @@ asynStatus Photron::readMemImage(epicsInt32 value) {
   }
   
   transferBitDepth = 8 * pixelSize;
-  dataSize = this->memWidth * this->memHeight * pixelSize;
-  pBuf = malloc(dataSize);
+  dataSize = this->memWidth * this->memHeight * pixelSize;
+  pBuf = malloc(dataSize);
+  memset(&tData, 0, sizeof(tData));
+  
+  epicsTimeGetCurrent(&startTime);
+  
+  // The prefetch task is restarted around this frame by the caller
+  waitForPrefetch();
+  
+  // Use the cached frame if there is one
+  if (!previewCacheGet(value, pBuf, dataSize, &tData)) {
+    // Retrieve a frame
+    nRet = PDC_GetMemImageData(this->nDeviceNo, this->nChildNo, value,
+                               transferBitDepth, pBuf, &nErrorCode);
+    if (nRet == PDC_FAILED) {
+      printf("PDC_GetMemImageData Error %d\n", nErrorCode);
+      cacheFrame = 0;
+    } else {
+      printf("PDC_GetMemImageData Succeeded\n");
+      cacheFrame = 1;
+    }
+    
+    // Retrieve frame time
+    if (this->tMode == 1) {
+      nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, value,
+                                &tData, &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+        cacheFrame = 0;
+      }
+    }
+    
+    if (cacheFrame) {
+      previewCachePut(value, pBuf, dataSize, &tData);
+    }
+  }
+  updatePreviewCacheParams();
+    
+  if (this->tMode == 1) {
+    setIntegerParam(PhotronMemIRIGDay, tData.m_nDayOfYear);
+    setIntegerParam(PhotronMemIRIGHour, tData.m_nHour);
+    setIntegerParam(PhotronMemIRIGMin, tData.m_nMinute);
+    setIntegerParam(PhotronMemIRIGSec, tData.m_nSecond);
+    setIntegerParam(PhotronMemIRIGUsec, tData.m_nMicroSecond);
+    setIntegerParam(PhotronMemIRIGSigEx, tData.m_ExistSignal);
+  }
+  
+  /* We save the most recent image buffer so it can be used in the read() 
+   * function. Now release it before getting a new version. */
+  if (this->pArrays[0]) 
+    this->pArrays[0]->release();
+  
+  /* Allocate the raw buffer */
+  dims[0] = memWidth;
+  dims[1] = memHeight;
+  pImage = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+  if (!pImage) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: error allocating buffer\n", driverName, functionName);
+    return(asynError);
+  }
+  
+  memcpy(pImage->pData, pBuf, dataSize);
+  this->pArrays[0] = NULL;
+  pImage = convertColor(pImage, &colorMode, NULL);
+  if (!pImage) {
+    return(asynError);
+  }
+  
+  this->pArrays[0] = pImage;
+  pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
+                              &colorMode);
+  addFrameAttributes(pImage, value);
+  pImage->getInfo(&arrayInfo);
+  setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
+  setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+  setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+  
+  /* Call the callbacks to update any changes */
+  callParamCallbacks();
+  
+  // Get the current parameters
+  getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+  getIntegerParam(PhotronPMStart, &start);
+  
+  // Set the image counters during playback to the values they would have
+  // if the frames were saved with the current settings
+  imageCounter = this->NDArrayCounterBackup + value - start;
+  setIntegerParam(NDArrayCounter, imageCounter);
+  numImagesCounter = value - start;
+  setIntegerParam(ADNumImagesCounter, numImagesCounter);
+  
+  /* Put the frame number and time stamp into the buffer */
+  pImage->uniqueId = imageCounter;
+  if (tMode == 1) {
+    // Absolute time from the IRIG clock model
+    this->timeDataToTimeStamp(&tData, &irigTime);
+    pImage->timeStamp = irigTime.secPastEpoch + irigTime.nsec / 1.e9;
+    pImage->epicsTS = irigTime;
+  }
+  else {
+    // Time from the frame time model
+    this->frameTimeToTimeStamp(value, &frameTime);
+    pImage->timeStamp = frameTime.secPastEpoch + frameTime.nsec / 1.e9;
+    pImage->epicsTS = frameTime;
+  }
+  
+  /* Get any attributes that have been defined for this driver */
+  this->getAttributes(pImage->pAttributeList);
+
+  if (arrayCallbacks) {
+    /* Call the NDArray callback */
+    /* Must release the lock here, or we can get into a deadlock, because we
+    * can block on the plugin lock, and the plugin can be calling us */
+    this->unlock();
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: calling imageData callback\n", driverName,
+              functionName);
+    doCallbacksGenericPointer(pImage, NDArrayData, 0);
+    this->lock();
+  }
+  
+  free(pBuf);
+  printf("Returning...\n");
+  return asynSuccess;
+}
+
+
+
+
+asynStatus Photron::readImageRange() {
+  asynStatus status = asynSuccess;
+  int index, transferBitDepth;
+  unsigned long nRet, nErrorCode;
+  PDC_IRIG_INFO tData;
+  //
+  NDArray *pImage;
+  NDArrayInfo_t arrayInfo;
+  int colorMode = NDColorModeMono;
+  //
+  void *pBuf;  /* Memory sequence pointer for storing a live image */
+  //
+  NDDataType_t dataType;
+  int pixelSize;
+  size_t dims[2];
+  size_t dataSize;
+  //
+  int imageCounter;
+  int numImages, numImagesCounter;
+  int imageMode;
+  int arrayCallbacks;
+  int abort = 0;
+  //double acquirePeriod, delay;
+  epicsTimeStamp startTime, endTime;
+  double elapsedTime;
+  epicsTimeStamp irigTime, frameTime;
+  //
+  int segStart[MAX_SAVE_RANGES];
+  int segEnd[MAX_SAVE_RANGES];
+  int segRecording[MAX_SAVE_RANGES];
+  int numSegments, segment, nextSegment, nextIndex, i;
+  int start, end, split;
+  int lossless;
+  int head, nextHead, headNumber;
+  size_t bufSize;
+  double stallTime = 0.0;
+  int dropped;
+  static const char *functionName = "readImageRange";
+  
+  // If the cancel button is pressed during preview mode, we need to avoid
+  // preloading a single image
+  if (this->abortFlag == 1) {
+    // reset the abort flag
+    this->abortFlag = 0;
+    return asynSuccess;
+  }
+  
+  if (this->pixelBits == 8) {
+    // 8 bits
+    dataType = NDUInt8;
+    pixelSize = 1;
+  } else {
+    // 12 bits (stored in 2 bytes)
+    dataType = NDUInt16;
+    pixelSize = 2;
+  }
+  
+  transferBitDepth = 8 * pixelSize;
+  // The SDK transfers frames into this buffer, which must hold a frame of 
+  // any head
+  bufSize = 0;
+  for (head=0; head<this->numHeads; head++) {
+    dataSize = this->headMemWidth[head] * this->headMemHeight[head] * pixelSize;
+    if (dataSize > bufSize) {
+      bufSize = dataSize;
+    }
+  }
+  pBuf = photronFrameMalloc(bufSize);
   
   epicsTimeGetCurrent(&startTime);
   
-  // Retrieve a frame
-  nRet = PDC_GetMemImageData(this->nDeviceNo, this->nChildNo, value,
-                             transferBitDepth, pBuf, &nErrorCode);
+  // Read the saved preview ranges, or the preview range if none were saved.
+  // The preview range can be split into the recordings of the random 
+  // trigger modes.
+  getIntegerParam(PhotronPMStart, &start);
+  getIntegerParam(PhotronPMEnd, &end);
+  getIntegerParam(PhotronSplitRecordings, &split);
+  numSegments = 0;
+  if (this->numSaveRanges > 0) {
+    for (i=0; i<this->numSaveRanges; i++) {
+      segStart[numSegments] = this->saveRangeStart[i];
+      segEnd[numSegments] = this->saveRangeEnd[i];
+      segRecording[numSegments] = -1;
+      numSegments++;
+    }
+  } else if (split && (this->numRecordings > 0)) {
+    for (i=0; i<this->numRecordings; i++) {
+      segStart[numSegments] = (this->recordingStart[i] > start) ? this->recordingStart[i] : start;
+      segEnd[numSegments] = (this->recordingEnd[i] < end) ? this->recordingEnd[i] : end;
+      segRecording[numSegments] = i;
+      if (segStart[numSegments] <= segEnd[numSegments]) {
+        numSegments++;
+      }
+    }
+  }
+  if (numSegments == 0) {
+    segStart[0] = start;
+    segEnd[0] = end;
+    segRecording[0] = -1;
+    numSegments = 1;
+  }
+  getIntegerParam(PhotronReadoutLossless, &lossless);
+  
+  // Reset the stall statistics for this readout
+  setDoubleParam(PhotronReadoutStallTime, 0.0);
+  setIntegerParam(PhotronReadoutStalls, 0);
+  callParamCallbacks();
+  
+  // Preload the first frame
+  segment = 0;
+  head = 0;
+  index = segStart[0];
+  nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->headChildNo[head], 
+                                  index, transferBitDepth, pBuf, &nErrorCode);
   if (nRet == PDC_FAILED) {
-    printf("PDC_GetMemImageData Error %d\n", nErrorCode);
-  } else {
-    printf("PDC_GetMemImageData Succeeded\n");
+    printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, index);
   }
+  
+  // The segments are read in one pass; the first frame of a segment is 
+  // preloaded while the last frame of the previous one is published. The 
+  // heads of a multi-head system are interleaved frame by frame, so that the
+  // transfer of one head's frame overlaps the publishing of another's.
+  while (1) {
+    dataSize = this->headMemWidth[head] * this->headMemHeight[head] * pixelSize;
     
-  // Retrieve frame time
-  if (this->tMode == 1) {
-    nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, value,
-                              &tData, &nErrorCode);
+    // Retrieve a frame
+    nRet = PDC_GetMemImageDataEnd(this->nDeviceNo, this->headChildNo[head],
+                                    transferBitDepth, pBuf, &nErrorCode);
     if (nRet == PDC_FAILED) {
-      printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+      printf("PDC_GetMemImageDataEnd Error %d\n", nErrorCode);
     }
     
-    setIntegerParam(PhotronMemIRIGDay, tData.m_nDayOfYear);
-    setIntegerParam(PhotronMemIRIGHour, tData.m_nHour);
-    setIntegerParam(PhotronMemIRIGMin, tData.m_nMinute);
-    setIntegerParam(PhotronMemIRIGSec, tData.m_nSecond);
-    setIntegerParam(PhotronMemIRIGUsec, tData.m_nMicroSecond);
-    setIntegerParam(PhotronMemIRIGSigEx, tData.m_ExistSignal);
+    // Retrieve frame time
+    if (this->tMode == 1) {
+    
+      nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->headChildNo[head], index,
+                                &tData, &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+      }
+      
+      setIntegerParam(PhotronMemIRIGDay, tData.m_nDayOfYear);
+      setIntegerParam(PhotronMemIRIGHour, tData.m_nHour);
+      setIntegerParam(PhotronMemIRIGMin, tData.m_nMinute);
+      setIntegerParam(PhotronMemIRIGSec, tData.m_nSecond);
+      setIntegerParam(PhotronMemIRIGUsec, tData.m_nMicroSecond);
+      setIntegerParam(PhotronMemIRIGSigEx, tData.m_ExistSignal);
+    }
+    
+    /* We save the most recent image buffer so it can be used in the read() 
+     * function. Now release it before getting a new version. */
+    if (this->pArrays[head]) {
+      this->pArrays[head]->release();
+      this->pArrays[head] = NULL;
+    }
+    
+    // In lossless mode, wait for the plugins to catch up before taking 
+    // another buffer from the pool. The next frame isn't requested from the
+    // camera until a buffer is available.
+    if (lossless) {
+      this->waitForReadoutBuffer(&stallTime, 0);
+    }
+  
+    /* Allocate the raw buffer */
+    dims[0] = this->headMemWidth[head];
+    dims[1] = this->headMemHeight[head];
+    pImage = allocReadoutArray(2, dims, dataType, 0);
+    while (!pImage && lossless && (this->abortFlag == 0)) {
+      // The pool has reached its memory limit; wait for a buffer to be freed
+      this->waitForReadoutBuffer(&stallTime, 1);
+      pImage = allocReadoutArray(2, dims, dataType, 0);
+    }
+    if (!pImage) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error allocating buffer\n", driverName, functionName);
+      photronFrameFree(pBuf);
+      return(asynError);
+    }
+    
+    memcpy(pImage->pData, pBuf, dataSize);
+    
+    // The references are captured from the live images of the first head
+    if (head == 0) {
+      pImage = correctFrame(pImage, lossless ? &stallTime : NULL);
+    }
+    pImage = convertColor(pImage, &colorMode, lossless ? &stallTime : NULL);
+    
+    // Keep to this camera's share of the readout bandwidth
+    throttleReadout(dataSize);
+    
+    // Allow user to abort readout
+    if (this->abortFlag == 1) {
+      // reset the abort flag
+      this->abortFlag = 0;
+      abort = 1;
+    }
+    
+    // Find the next frame; the same frame of the next head, if there is one
+    nextSegment = segment;
+    nextIndex = index + 1;
+    nextHead = 0;
+    if (head + 1 < this->numHeads) {
+      nextHead = head + 1;
+      nextIndex = index;
+    } else if (index >= segEnd[segment]) {
+      nextSegment = segment + 1;
+      if (nextSegment < numSegments) {
+        nextIndex = segStart[nextSegment];
+      } else {
+        // There isn't another frame to preload
+        abort = 1;
+      }
+    }
+    
+    if (abort == 0) {
+      // Start preloading the next frame
+      nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->headChildNo[nextHead], 
+                                      nextIndex, transferBitDepth, pBuf, 
+                                      &nErrorCode);
+      if (nRet == PDC_FAILED) {
+        printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, nextIndex);
+      }
+    } else {
+      printf("Aborting after posting this last image to plugins\n");
+    }
+    
+    if (!pImage) {
+      // The frame was dropped by the correction or the color conversion
+      getIntegerParam(PhotronReadoutDropped, &dropped);
+      setIntegerParam(PhotronReadoutDropped, dropped + 1);
+      callParamCallbacks();
+    } else {
+      this->pArrays[head] = pImage;
+      pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
+                                  &colorMode);
+      addFrameAttributes(pImage, index);
+      pImage->pAttributeList->add("SegmentId", "Preview range of the frame", 
+                                  NDAttrInt32, &segment);
+      if (this->numHeads > 1) {
+        headNumber = head + 1;
+        pImage->pAttributeList->add("Head", "Camera head of the frame", 
+                                    NDAttrInt32, &headNumber);
+      }
+      pImage->getInfo(&arrayInfo);
+      setIntegerParam(head, NDArraySize,  (int)arrayInfo.totalBytes);
+      setIntegerParam(head, NDArraySizeX, (int)arrayInfo.xSize);
+      setIntegerParam(head, NDArraySizeY, (int)arrayInfo.ySize);
+    
+      /* Get the current parameters. Each head has its own array counter; the 
+       * image counter counts the frames of the first head. */
+      getIntegerParam(head, NDArrayCounter, &imageCounter);
+      getIntegerParam(ADNumImages, &numImages);
+      getIntegerParam(ADNumImagesCounter, &numImagesCounter);
+      getIntegerParam(ADImageMode, &imageMode);
+      getIntegerParam(head, NDArrayCallbacks, &arrayCallbacks);
+      imageCounter++;
+      setIntegerParam(head, NDArrayCounter, imageCounter);
+      if (head == 0) {
+        numImagesCounter++;
+        setIntegerParam(ADNumImagesCounter, numImagesCounter);
+      }
+    
+      /* Call the callbacks to update any changes */
+      callParamCallbacks();
+      if (head > 0) {
+        callParamCallbacks(head);
+      }
+    
+      /* Put the frame number and time stamp into the buffer */
+      pImage->uniqueId = imageCounter;
+      if (tMode == 1) {
+        // Absolute time from the IRIG clock model
+        this->timeDataToTimeStamp(&tData, &irigTime);
+        pImage->timeStamp = irigTime.secPastEpoch + irigTime.nsec / 1.e9;
+        pImage->epicsTS = irigTime;
+      }
+      else {
+        // Time from the frame time model
+        this->frameTimeToTimeStamp(index, &frameTime);
+        pImage->timeStamp = frameTime.secPastEpoch + frameTime.nsec / 1.e9;
+        pImage->epicsTS = frameTime;
+      }
+    
+      /* Get any attributes that have been defined for this driver */
+      this->getAttributes(pImage->pAttributeList);
+    
+      if (arrayCallbacks) {
+        /* Call the NDArray callback */
+        /* Must release the lock here, or we can get into a deadlock, because we
+        * can block on the plugin lock, and the plugin can be calling us */
+        this->unlock();
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s:%s: calling imageData callback\n", driverName,
+                  functionName);
+        publishArray(pImage, head);
+        this->lock();
+      }
+    }
+    
+    if (abort == 1) {
+      // Is a sleep needed here?
+      break;
+    }
+    
+    // Each recording is counted as its own acquisition
+    if (segRecording[nextSegment] != segRecording[segment]) {
+      setIntegerParam(ADNumImagesCounter, 0);
+    }
+    
+    index = nextIndex;
+    segment = nextSegment;
+    head = nextHead;
   }
   
-  /* We save the most recent image buffer so it can be used in the read() 
-   * function. Now release it before getting a new version. */
-  if (this->pArrays[0]) 
-    this->pArrays[0]->release();
+  // The readout is complete when the plugins have all the frames
+  this->unlock();
+  flushCompression(10.0);
+  updateCompressStats(1);
+  this->lock();
   
-  /* Allocate the raw buffer */
-  dims[0] = memWidth;
-  dims[1] = memHeight;
-  pImage = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
-  if (!pImage) {
+  epicsTimeGetCurrent(&endTime);
+  elapsedTime = epicsTimeDiffInSeconds(&endTime, &startTime);
+  printf("Elapsed time: %f\n", elapsedTime);
+  if (lossless) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: time spent waiting for plugins: %f\n", 
+              driverName, functionName, stallTime);
+  }
+  
+  photronFrameFree(pBuf);
+  
+  return asynSuccess;
+}
+
+
+/** Takes frames from the compression queue. Each thread wakes the next one
+  * while there is more work, since an event wakes a single waiter. The pool
+  * serves every camera, so the threads have no driver argument. */
+static void PhotronCompressTaskC(void * /* drvPvt */) {
+  compressJob *pJob;
+  
+  while (1) {
+    epicsEventWait(compressPoolEventId);
+    while (1) {
+      epicsMutexLock(compressPoolMutex);
+      pJob = (compressJob *)ellFirst(&compressQueue);
+      if (pJob) {
+        ellDelete(&compressQueue, &(pJob->node));
+        if (ellCount(&compressQueue) > 0) {
+          epicsEventSignal(compressPoolEventId);
+        }
+      }
+      epicsMutexUnlock(compressPoolMutex);
+      if (!pJob) {
+        break;
+      }
+      pJob->pCamera->compressJobDone(pJob);
+    }
+  }
+}
+
+
+/** Starts compression threads until the pool has compressNumThreads */
+static void startCompressThreads() {
+  epicsMutexLock(compressPoolMutex);
+  while (compressThreadsRunning < compressNumThreads) {
+    if (epicsThreadCreate("PhotronCompressTask", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)PhotronCompressTaskC, NULL) == NULL) {
+      printf("%s:startCompressThreads epicsThreadCreate failure\n", 
+             driverName);
+      break;
+    }
+    compressThreadsRunning++;
+  }
+  epicsMutexUnlock(compressPoolMutex);
+}
+
+
+/** Passes a frame to the plugins, through the compression pool if a codec 
+  * is selected. Must be called without the driver lock. Blocks while 
+  * COMPRESS_MAX_PENDING frames of this camera are in the pool. */
+void Photron::publishArray(NDArray *pImage, int addr) {
+  compressJob *pJob;
+  int codec = this->compressCodec;
+  
+  if (codec == COMPRESS_NONE) {
+    doCallbacksGenericPointer(pImage, NDArrayData, addr);
+    return;
+  }
+  
+  startCompressThreads();
+  // The statistics are published from the camera's own thread, since the 
+  // pool threads must not take the driver lock
+  updateCompressStats(0);
+  
+  pJob = (compressJob *)calloc(1, sizeof(compressJob));
+  if (!pJob) {
+    doCallbacksGenericPointer(pImage, NDArrayData, addr);
+    return;
+  }
+  pImage->reserve();
+  pJob->pCamera = this;
+  pJob->pArray = pImage;
+  pJob->addr = addr;
+  pJob->codec = codec;
+  
+  epicsMutexLock(this->compressMutex);
+  while ((this->compressSubmitSeq - this->compressPublishSeq) >= 
+         COMPRESS_MAX_PENDING) {
+    epicsMutexUnlock(this->compressMutex);
+    epicsEventWait(this->compressSpaceEventId);
+    epicsMutexLock(this->compressMutex);
+  }
+  pJob->seq = this->compressSubmitSeq++;
+  epicsMutexUnlock(this->compressMutex);
+  
+  epicsMutexLock(compressPoolMutex);
+  ellAdd(&compressQueue, &(pJob->node));
+  epicsMutexUnlock(compressPoolMutex);
+  epicsEventSignal(compressPoolEventId);
+}
+
+
+/** Returns a compressed copy of pIn, or NULL if it can't be compressed. 
+  * bslz4 data has the 12-byte header of the HDF5 bitshuffle filter, the
+  * same as NDPluginCodec produces. */
+NDArray *Photron::compressArray(NDArray *pIn, int codec) {
+#ifdef HAVE_BITSHUFFLE
+  NDArrayInfo_t info;
+  NDArray *pOut;
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  size_t bound, blockSize;
+  epicsInt64 compSize;
+  epicsUInt64 totalBytes;
+  unsigned char *pHeader;
+  int i;
+  
+  pIn->getInfo(&info);
+  for (i=0; i<pIn->ndims; i++) {
+    dims[i] = pIn->dims[i].size;
+  }
+  
+  if (codec == COMPRESS_LZ4) {
+    bound = LZ4_compressBound((int)info.totalBytes);
+  } else {
+    bound = bshuf_compress_lz4_bound(info.nElements, info.bytesPerElement, 0)
+            + 12;
+  }
+  // Compressed readout frames are still readout arrays
+  pOut = pIn->pNDArrayPool->alloc(pIn->ndims, dims, pIn->dataType, bound, 
+                                  NULL);
+  if (!pOut) {
+    return NULL;
+  }
+  pIn->pNDArrayPool->copy(pIn, pOut, false, false, false);
+  
+  if (codec == COMPRESS_LZ4) {
+    compSize = LZ4_compress_default((const char *)pIn->pData, 
+                                    (char *)pOut->pData, 
+                                    (int)info.totalBytes, (int)bound);
+    pOut->codec.name = "lz4";
+  } else {
+    // Big-endian uncompressed size and block size in bytes
+    pHeader = (unsigned char *)pOut->pData;
+    totalBytes = info.totalBytes;
+    blockSize = bshuf_default_block_size(info.bytesPerElement) * 
+                info.bytesPerElement;
+    for (i=0; i<8; i++) {
+      pHeader[i] = (unsigned char)(totalBytes >> (8 * (7 - i)));
+    }
+    for (i=0; i<4; i++) {
+      pHeader[8 + i] = (unsigned char)(blockSize >> (8 * (3 - i)));
+    }
+    compSize = bshuf_compress_lz4(pIn->pData, pHeader + 12, info.nElements,
+                                  info.bytesPerElement, 0);
+    if (compSize > 0) {
+      compSize += 12;
+    }
+    pOut->codec.name = "bslz4";
+  }
+  
+  if (compSize <= 0) {
+    pOut->release();
+    return NULL;
+  }
+  pOut->compressedSize = (size_t)compSize;
+  return pOut;
+#else
+  // writeInt32 doesn't allow compression in this build
+  (void)pIn;
+  (void)codec;
+  return NULL;
+#endif
+}
+
+
+/** Called by the compression pool for each frame. Compresses it and then 
+  * publishes the frames of this camera that are ready, in order. Only one 
+  * thread publishes at a time; others leave their frames in the ring. */
+void Photron::compressJobDone(compressJob *pJob) {
+  NDArray *pOut;
+  NDArrayInfo_t info;
+  epicsTimeStamp startTime, endTime;
+  compressJob *pNext;
+  static const char *functionName = "compressJobDone";
+  
+  epicsTimeGetCurrent(&startTime);
+  pOut = compressArray(pJob->pArray, pJob->codec);
+  epicsTimeGetCurrent(&endTime);
+  
+  if (pOut) {
+    pJob->pArray->getInfo(&info);
+    epicsMutexLock(this->compressMutex);
+    this->compressBytesIn += info.totalBytes;
+    this->compressBytesOut += pOut->compressedSize;
+    this->compressSeconds += epicsTimeDiffInSeconds(&endTime, &startTime);
+    epicsMutexUnlock(this->compressMutex);
+    pJob->pArray->release();
+    pJob->pArray = pOut;
+  } else {
+    // Publish the frame uncompressed rather than lose it
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: error allocating buffer\n", driverName, functionName);
-    return(asynError);
+              "%s:%s: error compressing frame %d\n", driverName, functionName,
+              pJob->pArray->uniqueId);
   }
   
-  memcpy(pImage->pData, pBuf, dataSize);
+  epicsMutexLock(this->compressMutex);
+  this->compressRing[pJob->seq % COMPRESS_MAX_PENDING] = pJob;
+  if (this->compressPublishing) {
+    epicsMutexUnlock(this->compressMutex);
+    return;
+  }
+  this->compressPublishing = 1;
+  while ((pNext = this->compressRing[this->compressPublishSeq % 
+                                     COMPRESS_MAX_PENDING]) != NULL) {
+    this->compressRing[this->compressPublishSeq % COMPRESS_MAX_PENDING] = NULL;
+    this->compressPublishSeq++;
+    epicsMutexUnlock(this->compressMutex);
+    
+    doCallbacksGenericPointer(pNext->pArray, NDArrayData, pNext->addr);
+    pNext->pArray->release();
+    free(pNext);
+    epicsEventSignal(this->compressSpaceEventId);
+    
+    epicsMutexLock(this->compressMutex);
+  }
+  this->compressPublishing = 0;
+  epicsMutexUnlock(this->compressMutex);
+}
+
+
+/** Updates the compression ratio and speed every COMPRESS_STATS_PERIOD, or
+  * now if force is set. Called by the thread that publishes the frames, 
+  * without the driver lock. */
+void Photron::updateCompressStats(int force) {
+  epicsTimeStamp now;
+  double bytesIn, bytesOut, seconds;
+  int numThreads;
   
-  this->pArrays[0] = pImage;
-  pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
-                              &colorMode);
-  pImage->getInfo(&arrayInfo);
-  setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
-  setIntegerParam(NDArraySizeX, (int)pImage->dims[0].size);
-  setIntegerParam(NDArraySizeY, (int)pImage->dims[1].size);
+  epicsTimeGetCurrent(&now);
+  epicsMutexLock(this->compressMutex);
+  if (!force && (epicsTimeDiffInSeconds(&now, &(this->compressStatsTime)) < 
+                 COMPRESS_STATS_PERIOD)) {
+    epicsMutexUnlock(this->compressMutex);
+    return;
+  }
+  bytesIn = this->compressBytesIn;
+  bytesOut = this->compressBytesOut;
+  seconds = this->compressSeconds;
+  this->compressBytesIn = 0.0;
+  this->compressBytesOut = 0.0;
+  this->compressSeconds = 0.0;
+  this->compressStatsTime = now;
+  epicsMutexUnlock(this->compressMutex);
   
-  /* Call the callbacks to update any changes */
+  if (bytesOut <= 0.0) {
+    return;
+  }
+  epicsMutexLock(compressPoolMutex);
+  numThreads = compressThreadsRunning;
+  epicsMutexUnlock(compressPoolMutex);
+  
+  this->lock();
+  setDoubleParam(PhotronCompressRatio, bytesIn / bytesOut);
+  if (seconds > 0.0) {
+    setDoubleParam(PhotronCompressSpeed, bytesIn / seconds / 1.e6);
+  }
+  setIntegerParam(PhotronCompressThreads, numThreads);
   callParamCallbacks();
+  this->unlock();
+}
+
+
+/** Waits until the compression pool has published all the frames of this 
+  * camera. Must be called without the driver lock. */
+void Photron::flushCompression(double timeout) {
+  epicsTimeStamp startTime, now;
   
-  // Get the current parameters
-  getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-  getIntegerParam(PhotronPMStart, &start);
+  epicsTimeGetCurrent(&startTime);
+  while (1) {
+    epicsMutexLock(this->compressMutex);
+    if (this->compressPublishSeq == this->compressSubmitSeq) {
+      epicsMutexUnlock(this->compressMutex);
+      return;
+    }
+    epicsMutexUnlock(this->compressMutex);
+    
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &startTime) > timeout) {
+      printf("%s: frames are still being compressed\n", this->portName);
+      return;
+    }
+    epicsEventWaitWithTimeout(this->compressSpaceEventId, 0.01);
+  }
+}
+
+
+/** Starts the readout queue's highest priority readouts while there are free
+  * slots. Must be called with readoutMutex held. */
+static void dispatchReadouts() {
+  readoutJob *pJob;
   
-  // Set the image counters during playback to the values they would have
-  // if the frames were saved with the current settings
-  imageCounter = this->NDArrayCounterBackup + value - start;
-  setIntegerParam(NDArrayCounter, imageCounter);
-  numImagesCounter = value - start;
-  setIntegerParam(ADNumImagesCounter, numImagesCounter);
+  while ((readoutMaxActive <= 0) || (readoutActive < readoutMaxActive)) {
+    pJob = (readoutJob *)ellFirst(&readoutQueue);
+    if (!pJob) {
+      break;
+    }
+    ellDelete(&readoutQueue, &(pJob->node));
+    readoutActive++;
+    readoutActiveShares += pJob->share;
+    epicsEventSignal(pJob->goEventId);
+  }
+}
+
+
+/** Queues the readout of this camera with the readout scheduler and waits 
+  * until it may start. Readouts with a higher ReadoutPriority start first; 
+  * readouts with the same priority start in the order they were queued.
+  * Returns asynError, without a slot, if the readout is aborted while it 
+  * waits; the readout is then removed from the queue and the abort is 
+  * consumed, as readImageRange does.
+  */
+asynStatus Photron::acquireReadoutSlot() {
+  readoutJob *pJob;
+  epicsTimeStamp queueTime, startTime;
+  int priority, share;
+  int queued;
+  
+  getIntegerParam(PhotronReadoutPriority, &priority);
+  getIntegerParam(PhotronReadoutShare, &share);
+  this->readoutSlot.priority = priority;
+  this->readoutSlot.share = (share < 1) ? 1 : share;
+  
+  epicsTimeGetCurrent(&queueTime);
   
-  /* Put the frame number and time stamp into the buffer */
-  pImage->uniqueId = imageCounter;
-  if (tMode == 1) {
-    // Absolute time
-    //irigSeconds = (((((tData.m_nDayOfYear * 24) + tData.m_nHour) * 60) + tData.m_nMinute) * 60) + tData.m_nSecond;
-    //pImage->timeStamp = (this->postIRIGStartTime).secPastEpoch + irigSeconds + (this->postIRIGStartTime).nsec / 1.e9 + tData.m_nMicroSecond / 1.e6;
-    // Relative time
-    this->timeDataToSec(&tData, &tNow);
-    this->timeDataToSec(&(this->tDataStart), &tStart);
-    tRel = tNow - tStart;
-    pImage->timeStamp = tRel;
-  }
-  else {
-    // Use theoretical time
-    pImage->timeStamp = 1.0 * value / this->memRate;
+  epicsMutexLock(readoutMutex);
+  // Insert after the queued readouts with the same or higher priority
+  pJob = (readoutJob *)ellLast(&readoutQueue);
+  while (pJob && (pJob->priority < priority)) {
+    pJob = (readoutJob *)ellPrevious(&(pJob->node));
   }
-  updateTimeStamp(&pImage->epicsTS);
+  ellInsert(&readoutQueue, pJob ? &(pJob->node) : NULL, &(this->readoutSlot.node));
+  dispatchReadouts();
+  epicsMutexUnlock(readoutMutex);
   
-  /* Get any attributes that have been defined for this driver */
-  this->getAttributes(pImage->pAttributeList);
-
-  if (arrayCallbacks) {
-    /* Call the NDArray callback */
-    /* Must release the lock here, or we can get into a deadlock, because we
-    * can block on the plugin lock, and the plugin can be calling us */
+  while (1) {
     this->unlock();
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-              "%s:%s: calling imageData callback\n", driverName,
-              functionName);
-    doCallbacksGenericPointer(pImage, NDArrayData, 0);
+    if (epicsEventWaitWithTimeout(this->readoutSlot.goEventId, 
+                                  READOUT_QUEUE_POLL) == epicsEventOK) {
+      this->lock();
+      break;
+    }
     this->lock();
+    if (this->abortFlag == 1) {
+      // Only the scheduler takes a readout off the queue, so a readout that
+      // isn't queued any more has its slot
+      epicsMutexLock(readoutMutex);
+      queued = (ellFind(&readoutQueue, &(this->readoutSlot.node)) >= 0);
+      if (queued) {
+        ellDelete(&readoutQueue, &(this->readoutSlot.node));
+      }
+      epicsMutexUnlock(readoutMutex);
+      if (queued) {
+        printf("Readout aborted while waiting for the readout scheduler\n");
+        this->abortFlag = 0;
+        return asynError;
+      }
+      epicsEventWait(this->readoutSlot.goEventId);
+      break;
+    }
   }
   
-  free(pBuf);
-  printf("Returning...\n");
+  epicsTimeGetCurrent(&startTime);
+  setDoubleParam(PhotronReadoutWaitTime, 
+                 epicsTimeDiffInSeconds(&startTime, &queueTime));
+  this->readoutRate = 0.0;
+  this->readoutRateBytes = 0.0;
+  this->readoutRateTime = startTime;
+  this->readoutPaceTime = startTime;
+  callParamCallbacks();
+  
   return asynSuccess;
 }
 
 
+/** Returns this camera's readout slot to the readout scheduler */
+void Photron::releaseReadoutSlot() {
+  epicsMutexLock(readoutMutex);
+  readoutActive--;
+  readoutActiveShares -= this->readoutSlot.share;
+  readoutTotalRate -= this->readoutRate;
+  if (readoutActive == 0) {
+    readoutTotalRate = 0.0;
+  }
+  dispatchReadouts();
+  epicsMutexUnlock(readoutMutex);
+  
+  this->readoutRate = 0.0;
+  setDoubleParam(PhotronReadoutMBps, 0.0);
+  callParamCallbacks();
+}
 
 
-asynStatus Photron::readImageRange() {
-  asynStatus status = asynSuccess;
-  int index, transferBitDepth;
-  unsigned long nRet, nErrorCode;
-  PDC_IRIG_INFO tData;
-  //
-  NDArray *pImage;
-  NDArrayInfo_t arrayInfo;
-  int colorMode = NDColorModeMono;
-  //
-  void *pBuf;  /* Memory sequence pointer for storing a live image */
-  //
-  NDDataType_t dataType;
-  int pixelSize;
-  size_t dims[2];
-  size_t dataSize;
-  //
-  int imageCounter;
-  int numImages, numImagesCounter;
-  int imageMode;
-  int arrayCallbacks;
-  int abort = 0;
-  //double acquirePeriod, delay;
-  epicsTimeStamp startTime, endTime;
-  double elapsedTime;
-  epicsUInt32 irigSeconds;
-  //
-  int start, end;
-  static const char *functionName = "readImageRange";
+/** Accounts for a frame that was read out and, if the readout bandwidth is 
+  * limited, sleeps until this camera's share of the bandwidth allows another
+  * frame. Also updates the throughput about once a second.
+  * \param[in] bytes Size of the frame
+  */
+void Photron::throttleReadout(size_t bytes) {
+  epicsTimeStamp now;
+  double rate, total, elapsed, delay;
+  
+  if (readoutMaxMBps > 0.0) {
+    epicsMutexLock(readoutMutex);
+    rate = readoutMaxMBps * 1.e6 * this->readoutSlot.share / 
+           ((readoutActiveShares > 0) ? readoutActiveShares : 1);
+    epicsMutexUnlock(readoutMutex);
+    
+    // The next frame may be read when this one has been paid for. Time that
+    // wasn't used isn't saved up.
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &(this->readoutPaceTime)) > 0.0) {
+      this->readoutPaceTime = now;
+    }
+    epicsTimeAddSeconds(&(this->readoutPaceTime), bytes / rate);
+    delay = epicsTimeDiffInSeconds(&(this->readoutPaceTime), &now);
+    if (delay > 0.0) {
+      this->unlock();
+      epicsThreadSleep(delay);
+      this->lock();
+    }
+  }
   
-  // If the cancel button is pressed during preview mode, we need to avoid
-  // preloading a single image
-  if (this->abortFlag == 1) {
-    // reset the abort flag
-    this->abortFlag = 0;
+  this->readoutRateBytes += bytes;
+  epicsTimeGetCurrent(&now);
+  elapsed = epicsTimeDiffInSeconds(&now, &(this->readoutRateTime));
+  if (elapsed >= 1.0) {
+    rate = this->readoutRateBytes / elapsed / 1.e6;
+    epicsMutexLock(readoutMutex);
+    readoutTotalRate += rate - this->readoutRate;
+    total = readoutTotalRate;
+    epicsMutexUnlock(readoutMutex);
+    this->readoutRate = rate;
+    this->readoutRateBytes = 0.0;
+    this->readoutRateTime = now;
+    setDoubleParam(PhotronReadoutMBps, rate);
+    setDoubleParam(PhotronReadoutTotalMBps, total);
+  }
+}
+
+
+/** Reserve buffers for reading out a recording.
+  * This must be called after readMem, since the buffers are sized for the 
+  * memory resolution of the recording: the largest head's frame as the 
+  * plugins receive it, after correction and color conversion. The buffers 
+  * are written to so that the pages are committed before the readout 
+  * begins, then they are released to the free list of pReservePool, where 
+  * allocReadoutArray will find them.
+  */
+asynStatus Photron::reserveReadoutBuffers() {
+  int numBuffers, numReserved;
+  NDArray **pBuffers;
+  size_t dims[1];
+  size_t numPixels, bytesPerPixel;
+  int head, corrMode, corrOutput, colorMode;
+  static const char *functionName = "reserveReadoutBuffers";
+  
+  getIntegerParam(PhotronReadoutReserve, &numBuffers);
+  if (numBuffers <= 0) {
     return asynSuccess;
   }
   
-  if (this->pixelBits == 8) {
-    // 8 bits
-    dataType = NDUInt8;
-    pixelSize = 1;
-  } else {
-    // 12 bits (stored in 2 bytes)
-    dataType = NDUInt16;
-    pixelSize = 2;
+  // Buffers returned by the plugins since the last readout
+  releaseReadoutBuffers();
+  
+  numPixels = 0;
+  for (head=0; head<this->numHeads; head++) {
+    if (this->headMemWidth[head] * this->headMemHeight[head] > numPixels) {
+      numPixels = this->headMemWidth[head] * this->headMemHeight[head];
+    }
   }
   
-  transferBitDepth = 8 * pixelSize;
-  dataSize = this->memWidth * this->memHeight * pixelSize;
-  pBuf = malloc(dataSize);
+  bytesPerPixel = (this->pixelBits == 8) ? 1 : 2;
+  getIntegerParam(PhotronCorrMode, &corrMode);
+  getIntegerParam(PhotronCorrOutput, &corrOutput);
+  getIntegerParam(NDColorMode, &colorMode);
+  if ((bytesPerPixel == 2) && (corrMode != CORR_MODE_OFF) && 
+      (corrOutput == CORR_OUTPUT_FLOAT32)) {
+    bytesPerPixel = sizeof(epicsFloat32);
+  } else if ((this->colorType == PDC_COLORTYPE_COLOR) && 
+             (colorMode == NDColorModeRGB1)) {
+    bytesPerPixel *= 3;
+  }
+  this->reserveBufferSize = numPixels * bytesPerPixel;
   
-  epicsTimeGetCurrent(&startTime);
+  pBuffers = (NDArray **)calloc(numBuffers, sizeof(NDArray *));
+  if (!pBuffers) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: error allocating buffer list\n", 
+              driverName, functionName);
+    return asynError;
+  }
   
-  getIntegerParam(PhotronPMStart, &start);
-  getIntegerParam(PhotronPMEnd, &end);
+  // The pool reuses a free buffer for any array that fits in it
+  dims[0] = this->reserveBufferSize;
+  for (numReserved=0; numReserved<numBuffers; numReserved++) {
+    pBuffers[numReserved] = this->pReservePool->alloc(1, dims, NDUInt8, 0, NULL);
+    if (!pBuffers[numReserved]) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: only %d of %d buffers could be reserved\n", 
+                driverName, functionName, numReserved, numBuffers);
+      break;
+    }
+    // Touch every page of the buffer
+    memset(pBuffers[numReserved]->pData, 0, this->reserveBufferSize);
+    this->reservedBytes += pBuffers[numReserved]->dataSize;
+  }
   
-  // TODO: Catch random trigger modes, see if fewer than the specified
-  // number of recordings have occurred, then omit the first acquisition
+  // Return the buffers to the free list
+  while (numReserved > 0) {
+    numReserved--;
+    pBuffers[numReserved]->release();
+  }
+  free(pBuffers);
   
-  // Preload the first frame
-  nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, start,
-                                  transferBitDepth, pBuf, &nErrorCode);
-  if (nRet == PDC_FAILED) {
-    printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, start);
+  setDoubleParam(PhotronReadoutReservedBytes, (double)this->reservedBytes);
+  callParamCallbacks();
+  
+  return asynSuccess;
+}
+
+
+/** Free the buffers reserved by reserveReadoutBuffers. Only the free 
+  * buffers of pReservePool are freed; arrays that are still held by plugins
+  * return to it when the plugins release them, and are freed with the next
+  * reservation.
+  */
+asynStatus Photron::releaseReadoutBuffers() {
+  static const char *functionName = "releaseReadoutBuffers";
+  
+  this->pReservePool->emptyFreeList();
+  if (this->reservedBytes == 0) {
+    return asynSuccess;
   }
+  this->reservedBytes = 0;
   
-  for (index=start; index<=end; index++) {
-    // Retrieve a frame
-    nRet = PDC_GetMemImageDataEnd(this->nDeviceNo, this->nChildNo,
-                                    transferBitDepth, pBuf, &nErrorCode);
-    if (nRet == PDC_FAILED) {
-      printf("PDC_GetMemImageDataEnd Error %d\n", nErrorCode);
+  setDoubleParam(PhotronReadoutReservedBytes, 0.0);
+  callParamCallbacks();
+  
+  return asynSuccess;
+}
+
+
+/** Allocates an array for the readout, from the reserved buffers while 
+  * there are free ones large enough, otherwise from the driver's pool.
+  * \param[in] dataSize Size of the data in bytes, or 0 to size it from the
+  *            dimensions and data type, as NDArrayPool::alloc does
+  */
+NDArray *Photron::allocReadoutArray(int ndims, size_t *dims, 
+                                    NDDataType_t dataType, size_t dataSize) {
+  NDArray *pArray;
+  size_t size;
+  int i;
+  
+  if ((this->reservedBytes > 0) && (this->pReservePool->getNumFree() > 0)) {
+    size = dataSize;
+    if (size == 0) {
+      size = (dataType == NDFloat32) ? sizeof(epicsFloat32) : 
+             (dataType == NDUInt16) ? sizeof(epicsUInt16) : 1;
+      for (i=0; i<ndims; i++) {
+        size *= dims[i];
+      }
     }
-    
-    // Retrieve frame time
-    if (this->tMode == 1) {
-    
-      nRet = PDC_GetMemIRIGData(this->nDeviceNo, this->nChildNo, index,
-                                &tData, &nErrorCode);
-      if (nRet == PDC_FAILED) {
-        printf("PDC_GetMemIRIGData Error %d\n", nErrorCode);
+    if (((dataType == NDUInt8) || (dataType == NDUInt16) || 
+         (dataType == NDFloat32)) && (size <= this->reserveBufferSize)) {
+      pArray = this->pReservePool->alloc(ndims, dims, dataType, dataSize, 
+                                         NULL);
+      if (pArray) {
+        return pArray;
       }
-      
-      setIntegerParam(PhotronMemIRIGDay, tData.m_nDayOfYear);
-      setIntegerParam(PhotronMemIRIGHour, tData.m_nHour);
-      setIntegerParam(PhotronMemIRIGMin, tData.m_nMinute);
-      setIntegerParam(PhotronMemIRIGSec, tData.m_nSecond);
-      setIntegerParam(PhotronMemIRIGUsec, tData.m_nMicroSecond);
-      setIntegerParam(PhotronMemIRIGSigEx, tData.m_ExistSignal);
     }
-    
-    /* We save the most recent image buffer so it can be used in the read() 
-     * function. Now release it before getting a new version. */
-    if (this->pArrays[0]) 
-      this->pArrays[0]->release();
+  }
   
-    /* Allocate the raw buffer */
-    dims[0] = memWidth;
-    dims[1] = memHeight;
-    pImage = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
-    if (!pImage) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s: error allocating buffer\n", driverName, functionName);
-      return(asynError);
-    }
-    
-    memcpy(pImage->pData, pBuf, dataSize);
-    
-    // Allow user to abort readout
+  return this->pReadoutPool->alloc(ndims, dims, dataType, dataSize, NULL);
+}
+
+
+/** Allocates the array that replaces pRaw after a conversion; a readout 
+  * array for the frames of a readout, otherwise an array of the driver's 
+  * pool. */
+NDArray *Photron::allocOutputArray(NDArray *pRaw, int ndims, size_t *dims, 
+                                   NDDataType_t dataType) {
+  if (pRaw->pNDArrayPool == this->pNDArrayPool) {
+    return this->pNDArrayPool->alloc(ndims, dims, dataType, 0, NULL);
+  }
+  return allocReadoutArray(ndims, dims, dataType, 0);
+}
+
+
+PhotronArrayPool::PhotronArrayPool(asynNDArrayDriver *pDriver, 
+                                   size_t maxMemory, 
+                                   epicsEventId releaseEventId)
+    : NDArrayPool(pDriver, maxMemory), releaseEventId(releaseEventId) {
+}
+
+/** Called by NDArrayPool::release with the pool's list lock held, so it 
+  * only signals the event */
+void PhotronArrayPool::onReleaseArray(NDArray *pArray) {
+  NDArrayPool::onReleaseArray(pArray);
+  epicsEventSignal(this->releaseEventId);
+}
+
+
+/** Wait until the plugins have released enough arrays for the readout to 
+  * continue without frames being dropped from the plugin queues.
+  * The readout arrays that are in use (queued or being processed by a 
+  * plugin, or the last frame the driver keeps) are counted as in-flight, so
+  * keeping them below the smallest plugin queue size prevents non-blocking
+  * plugins from dropping frames. Only the arrays of pReadoutPool and 
+  * pReservePool are counted; live images and the arrays of other cameras 
+  * and plugins are not.
+  * The readout pools signal freeBufferEventId each time an array is 
+  * released, and abort requests signal it too. EPICS has no condition 
+  * variable, but an epicsEvent keeps a signal that arrives between the 
+  * count and the wait, so no release is missed; a stale signal only costs
+  * another count.
+  * \param[in,out] stallTime Accumulated stall time for the current readout
+  * \param[in] force Wait at least one poll period, even if the number of
+  *            in-flight arrays is below the limit (used when alloc fails)
+  */
+asynStatus Photron::waitForReadoutBuffer(double *stallTime, int force) {
+  int maxInFlight, inFlight, stalls;
+  epicsTimeStamp stallStart, stallEnd;
+  static const char *functionName = "waitForReadoutBuffer";
+  
+  getIntegerParam(PhotronReadoutMaxInFlight, &maxInFlight);
+  if (maxInFlight < 1) {
+    maxInFlight = 1;
+  }
+  
+  inFlight = this->pReadoutPool->getNumBuffers() - this->pReadoutPool->getNumFree() +
+             this->pReservePool->getNumBuffers() - this->pReservePool->getNumFree();
+  if ((inFlight < maxInFlight) && !force) {
+    return asynSuccess;
+  }
+  
+  getIntegerParam(PhotronReadoutStalls, &stalls);
+  setIntegerParam(PhotronReadoutStalls, stalls + 1);
+  callParamCallbacks();
+  
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: waiting for plugins; %d arrays in flight\n", 
+            driverName, functionName, inFlight);
+  
+  epicsTimeGetCurrent(&stallStart);
+  do {
     if (this->abortFlag == 1) {
-      // reset the abort flag
-      this->abortFlag = 0;
-      abort = 1;
-    }
-    
-    // Check to see if we're on the last frame
-    if (index == end) {
-      // There isn't another frame to preload
-      abort = 1;
-    }
-    
-    if (abort == 0) {
-      // Start preloading the next frame
-      nRet = PDC_GetMemImageDataStart(this->nDeviceNo, this->nChildNo, (index+1),
-                                      transferBitDepth, pBuf, &nErrorCode);
-      if (nRet == PDC_FAILED) {
-        printf("PDC_GetMemImageDataStart Error %d; index = %d\n", nErrorCode, (index+1));
-      }
-    } else {
-      printf("Aborting after posting this last image to plugins\n");
-    }
-    
-    this->pArrays[0] = pImage;
-    pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, 
-                                &colorMode);
-    pImage->getInfo(&arrayInfo);
-    setIntegerParam(NDArraySize,  (int)arrayInfo.totalBytes);
-    setIntegerParam(NDArraySizeX, (int)pImage->dims[0].size);
-    setIntegerParam(NDArraySizeY, (int)pImage->dims[1].size);
-    
-    /* Call the callbacks to update any changes */
-    callParamCallbacks();
-    
-    /* Get the current parameters */
-    getIntegerParam(NDArrayCounter, &imageCounter);
-    getIntegerParam(ADNumImages, &numImages);
-    getIntegerParam(ADNumImagesCounter, &numImagesCounter);
-    getIntegerParam(ADImageMode, &imageMode);
-    getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
-    imageCounter++;
-    numImagesCounter++;
-    setIntegerParam(NDArrayCounter, imageCounter);
-    setIntegerParam(ADNumImagesCounter, numImagesCounter);
-    
-    /* Put the frame number and time stamp into the buffer */
-    pImage->uniqueId = imageCounter;
-    if (tMode == 1) {
-      irigSeconds = (((((tData.m_nDayOfYear * 24) + tData.m_nHour) * 60) + tData.m_nMinute) * 60) + tData.m_nSecond;
-      pImage->timeStamp = (this->postIRIGStartTime).secPastEpoch + irigSeconds + (this->postIRIGStartTime).nsec / 1.e9 + tData.m_nMicroSecond / 1.e6;
-    }
-    else {
-      pImage->timeStamp = startTime.secPastEpoch + startTime.nsec / 1.e9;
-    }
-    updateTimeStamp(&pImage->epicsTS);
-    
-    /* Get any attributes that have been defined for this driver */
-    this->getAttributes(pImage->pAttributeList);
-    
-    if (arrayCallbacks) {
-      /* Call the NDArray callback */
-      /* Must release the lock here, or we can get into a deadlock, because we
-      * can block on the plugin lock, and the plugin can be calling us */
-      this->unlock();
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-                "%s:%s: calling imageData callback\n", driverName,
-                functionName);
-      doCallbacksGenericPointer(pImage, NDArrayData, 0);
-      this->lock();
-    }
-    
-    if (abort == 1) {
-      // Is a sleep needed here?
       break;
     }
-  }
-  
-  epicsTimeGetCurrent(&endTime);
-  elapsedTime = epicsTimeDiffInSeconds(&endTime, &startTime);
-  printf("Elapsed time: %f\n", elapsedTime);
+    // Release the lock so the plugins (and abort requests) aren't blocked
+    this->unlock();
+    epicsEventWaitWithTimeout(this->freeBufferEventId, STALL_WAIT_TIMEOUT);
+    this->lock();
+    inFlight = this->pReadoutPool->getNumBuffers() - this->pReadoutPool->getNumFree() +
+               this->pReservePool->getNumBuffers() - this->pReservePool->getNumFree();
+  } while (inFlight >= maxInFlight);
+  epicsTimeGetCurrent(&stallEnd);
   
-  free(pBuf);
+  *stallTime += epicsTimeDiffInSeconds(&stallEnd, &stallStart);
+  setDoubleParam(PhotronReadoutStallTime, *stallTime);
+  callParamCallbacks();
   
+  if (this->abortFlag == 1) {
+    return asynError;
+  }
   return asynSuccess;
 }
 
@@ -3537,6 +8166,7 @@ asynStatus Photron::setGeometry() {
   }
   
   // There are fixed resolutions that can be used
+  waitForGrab();
   nRet = PDC_SetResolution(this->nDeviceNo, this->nChildNo, 
                            sizeX, sizeY, &nErrorCode);
   if (nRet == PDC_FAILED) {
@@ -3660,6 +8290,7 @@ asynStatus Photron::setPixelFormat() {
   
   status |= getIntegerParam(NDDataType, &dataType);
   
+  waitForGrab();
   if (dataType == NDUInt8) {
     this->pixelBits = 8;
   } else if (dataType == NDUInt16) {
@@ -3681,6 +8312,7 @@ asynStatus Photron::setTransferOption() {
   unsigned long nErrorCode;
   int status = asynSuccess;
   int n8BitSel;
+  unsigned long nBayer;
   
   static const char *functionName = "setTransferOption";
   
@@ -3688,8 +8320,13 @@ asynStatus Photron::setTransferOption() {
   
   // TODO: confirm that we are in 8-bit acquisition mode, 
   //       otherwise this isn't necessary
+  // Color cameras send the Bayer data, one sample per pixel like a mono 
+  // camera. convertColor demosaics it if RGB1 is selected.
+  nBayer = (this->colorType == PDC_COLORTYPE_COLOR) ? PDC_FUNCTION_ON 
+                                                     : PDC_FUNCTION_OFF;
+  waitForGrab();
   nRet = PDC_SetTransferOption(this->nDeviceNo, this->nChildNo, n8BitSel,
-                               PDC_FUNCTION_OFF, PDC_FUNCTION_OFF, &nErrorCode);
+                               nBayer, PDC_FUNCTION_OFF, &nErrorCode);
   if (nRet == PDC_FAILED) {
     printf("PDC_GetMaxResolution failed %d\n", nErrorCode);
     return asynError;
@@ -4292,6 +8929,8 @@ asynStatus Photron::setRecordRate(epicsInt32 value, epicsInt32 flag) {
     return status;
   }
   
+  // The record rate can change the resolution
+  waitForGrab();
   nRet = PDC_SetRecordRate(this->nDeviceNo, this->nChildNo, value, &nErrorCode);
   if (nRet == PDC_FAILED) {
     printf("PDC_SetRecordRate Error %d\n", nErrorCode);
@@ -4437,6 +9076,7 @@ asynStatus Photron::setVariableChannel(epicsInt32 value) {
   {
     if (this->varRate > 59) {
       // Only set the variable channel if the channel is not empty
+      waitForGrab();
       nRet = PDC_SetVariableChannel(this->nDeviceNo, this->nChildNo, chan, 
                                     &nErrorCode);
       if (nRet == PDC_FAILED) {
@@ -4589,6 +9229,7 @@ asynStatus Photron::readParameters() {
   int tmode, smode;
   int index;
   int eVal, eStatus;
+  int pixelGain;
   char bitDepthChar;
   static const char *functionName = "readParameters";    
   
@@ -4599,6 +9240,7 @@ asynStatus Photron::readParameters() {
   nRet = PDC_GetStatus(this->nDeviceNo, &(this->nStatus), &nErrorCode);
   if (nRet == PDC_FAILED) {
     printf("PDC_GetStatus (#5) failed %d\n", nErrorCode);
+    checkLinkError(nErrorCode);
     return asynError;
   }
   status |= setIntegerParam(PhotronStatus, this->nStatus);
@@ -4790,6 +9432,12 @@ asynStatus Photron::readParameters() {
   
   // getGeometry needs to be called after the resolution list has been updated
   status |= getGeometry();
+  status |= readHeadGeometry();
+  getIntegerParam(PhotronPixelGainCorr, &pixelGain);
+  if (pixelGain) {
+    loadPixelGain(0);
+  }
+  updateCorrectionParams();
   
   /* Call the callbacks to update the values in higher layers */
   callParamCallbacks();
@@ -4969,6 +9617,8 @@ void Photron::report(FILE *fp, int details) {
     fprintf(fp, "  Sensor width:      %d\n",  (int)this->sensorWidth);
     fprintf(fp, "  Sensor height:     %d\n",  (int)this->sensorHeight);
     fprintf(fp, "  Sensor bits:       %d\n",  (int)this->sensorBits);
+    fprintf(fp, "  Color:             %s\n",  
+            (this->colorType == PDC_COLORTYPE_COLOR) ? "Yes" : "No");
     fprintf(fp, "  Max Child Dev #:   %d\n",  (int)this->maxChildDevCount);
     fprintf(fp, "  Child Dev #:       %d\n",  (int)this->childDevCount);
     fprintf(fp, "  In ports:          %d\n",  (int)this->inPorts);
@@ -4987,6 +9637,19 @@ void Photron::report(FILE *fp, int details) {
     fprintf(fp, "    R Frames:        %d\n",  (int)this->trigRFrames);
     fprintf(fp, "    R Count:         %d\n",  (int)this->trigRCount);
     fprintf(fp, "  IRIG:              %d\n",  (int)this->IRIG);
+    fprintf(fp, "    Model samples:   %d\n",  this->irigNumSamples);
+    fprintf(fp, "    Model slope:     %.9f\n",  this->irigSlope);
+    fprintf(fp, "  Heads:             %d\n",  this->numHeads);
+    fprintf(fp, "  SIMD level:        %d\n",  getSimdLevel());
+    fprintf(fp, "  Compress threads:  %d\n",  compressThreadsRunning);
+    fprintf(fp, "  Large pages:       %d\n",  largePagesEnabled);
+    if (largePagesEnabled) {
+      fprintf(fp, "    Page size:       %d\n",  (int)largePageSize);
+      fprintf(fp, "    Large allocs:    %d\n",  
+              (int)epicsAtomicGetSizeT(&largePageAllocs));
+      fprintf(fp, "    Locked allocs:   %d\n",  
+              (int)epicsAtomicGetSizeT(&lockedPageAllocs));
+    }
   }
   
   if (details > 4) {
@@ -5071,15 +9734,90 @@ void Photron::report(FILE *fp, int details) {
   *            and maxBuffers is, say 14. maxMemory = 1024x768x14 = 11010048 bytes (~11MB). 0=unlimited.
   * \param[in] priority The EPICS thread priority for this driver.  0=use asyn default.
   * \param[in] stackSize The size of the stack for the EPICS port thread. 0=use asyn default.
+  * \param[in] maxHeads Maximum number of camera heads of a multi-head system,
+  *            at most PDC_MAX_CHILD_DEVICE. Head N is asyn address N-1. 
+  *            Values below 2 use only the first head. Live images, the 
+  *            preview and playback only use the first head; the other heads 
+  *            are only read out from memory, and only their ADSizeX and ADSizeY
+  *            can be written.
   */
 
 extern "C" int PhotronConfig(const char *portName, const char *ipAddress,
                              int autoDetect, int maxBuffers, int maxMemory,
-                             int priority, int stackSize) {
+                             int priority, int stackSize, int maxHeads) {
   new Photron(portName, ipAddress, autoDetect,
               (maxBuffers < 0) ? 0 : maxBuffers,
               (maxMemory < 0) ? 0 : maxMemory, 
-              priority, stackSize);
+              priority, stackSize,
+              (maxHeads > PDC_MAX_CHILD_DEVICE) ? PDC_MAX_CHILD_DEVICE : maxHeads);
+  return(asynSuccess);
+}
+
+/** Configures the readout scheduler shared by all cameras in the IOC.
+  * \param[in] maxReadouts Maximum number of cameras reading out at the same 
+  *            time. 0=unlimited.
+  * \param[in] maxMBps Total readout bandwidth in MB/s, shared between the 
+  *            cameras reading out in proportion to their ReadoutShare. 
+  *            0=unlimited.
+  */
+extern "C" int PhotronReadoutConfig(int maxReadouts, double maxMBps) {
+  if (readoutMutex) {
+    epicsMutexLock(readoutMutex);
+  }
+  readoutMaxActive = (maxReadouts < 0) ? 0 : maxReadouts;
+  readoutMaxMBps = (maxMBps < 0.0) ? 0.0 : maxMBps;
+  if (readoutMutex) {
+    dispatchReadouts();
+    epicsMutexUnlock(readoutMutex);
+  }
+  return(asynSuccess);
+}
+
+/** Allocates the frame buffers of every NDArrayPool in the IOC, i.e. of all
+  * cameras and plugins, from locked, large-page-backed memory. This replaces
+  * the default frame allocator of ADCore for the whole process; it can't be
+  * limited to one camera. It should be called before any driver or plugin is
+  * configured. Needs the "Lock pages in memory" user right; normal pages are
+  * used if large pages aren't available. The allocator can't be removed 
+  * again once buffers have been allocated from it.
+  * \param[in] enable 1 to use large pages, 0 to keep the default allocator.
+  */
+extern "C" int PhotronLargePagesConfig(int enable) {
+  if (!enable) {
+    return(asynSuccess);
+  }
+  if (cameraList) {
+    printf("%s: PhotronLargePagesConfig should be called before PhotronConfig\n",
+           driverName);
+  }
+  enableLargePages();
+  return(asynSuccess);
+}
+
+/** Sets the number of threads of the compression pool, which is shared by
+  * all cameras. Can be called before or after the cameras are created; 
+  * threads are added but never removed.
+  */
+extern "C" int PhotronCompressConfig(int numThreads) {
+  int running = 0;
+  
+  if (numThreads < 1) {
+    numThreads = 1;
+  } else if (numThreads > COMPRESS_MAX_THREADS) {
+    numThreads = COMPRESS_MAX_THREADS;
+  }
+  if (compressPoolMutex) {
+    epicsMutexLock(compressPoolMutex);
+  }
+  compressNumThreads = numThreads;
+  if (compressPoolMutex) {
+    running = compressThreadsRunning;
+    epicsMutexUnlock(compressPoolMutex);
+  }
+  // Only a pool that is already in use is grown here
+  if (running) {
+    startCompressThreads();
+  }
   return(asynSuccess);
 }
 
@@ -5091,22 +9829,53 @@ static const iocshArg PhotronConfigArg3 = {"maxBuffers", iocshArgInt};
 static const iocshArg PhotronConfigArg4 = {"maxMemory", iocshArgInt};
 static const iocshArg PhotronConfigArg5 = {"priority", iocshArgInt};
 static const iocshArg PhotronConfigArg6 = {"stackSize", iocshArgInt};
+static const iocshArg PhotronConfigArg7 = {"maxHeads", iocshArgInt};
 static const iocshArg * const PhotronConfigArgs[] =  {&PhotronConfigArg0,
                                                       &PhotronConfigArg1,
                                                       &PhotronConfigArg2,
                                                       &PhotronConfigArg3,
                                                       &PhotronConfigArg4,
                                                       &PhotronConfigArg5,
-                                                      &PhotronConfigArg6};
-static const iocshFuncDef configPhotron = {"PhotronConfig", 7, 
+                                                      &PhotronConfigArg6,
+                                                      &PhotronConfigArg7};
+static const iocshFuncDef configPhotron = {"PhotronConfig", 8, 
                                            PhotronConfigArgs};
 static void configPhotronCallFunc(const iocshArgBuf *args) {
     PhotronConfig(args[0].sval, args[1].sval, args[2].ival, args[3].ival,
-                  args[4].ival, args[5].ival, args[6].ival);
+                  args[4].ival, args[5].ival, args[6].ival, args[7].ival);
+}
+
+static const iocshArg PhotronReadoutConfigArg0 = {"maxReadouts", iocshArgInt};
+static const iocshArg PhotronReadoutConfigArg1 = {"maxMBps", iocshArgDouble};
+static const iocshArg * const PhotronReadoutConfigArgs[] = {&PhotronReadoutConfigArg0,
+                                                            &PhotronReadoutConfigArg1};
+static const iocshFuncDef configPhotronReadout = {"PhotronReadoutConfig", 2, 
+                                                  PhotronReadoutConfigArgs};
+static void configPhotronReadoutCallFunc(const iocshArgBuf *args) {
+    PhotronReadoutConfig(args[0].ival, args[1].dval);
+}
+
+static const iocshArg PhotronLargePagesConfigArg0 = {"enable", iocshArgInt};
+static const iocshArg * const PhotronLargePagesConfigArgs[] = {&PhotronLargePagesConfigArg0};
+static const iocshFuncDef configPhotronLargePages = {"PhotronLargePagesConfig", 1, 
+                                                     PhotronLargePagesConfigArgs};
+static void configPhotronLargePagesCallFunc(const iocshArgBuf *args) {
+    PhotronLargePagesConfig(args[0].ival);
+}
+
+static const iocshArg PhotronCompressConfigArg0 = {"numThreads", iocshArgInt};
+static const iocshArg * const PhotronCompressConfigArgs[] = {&PhotronCompressConfigArg0};
+static const iocshFuncDef configPhotronCompress = {"PhotronCompressConfig", 1, 
+                                                   PhotronCompressConfigArgs};
+static void configPhotronCompressCallFunc(const iocshArgBuf *args) {
+    PhotronCompressConfig(args[0].ival);
 }
 
 static void PhotronRegister(void) {
     iocshRegister(&configPhotron, configPhotronCallFunc);
+    iocshRegister(&configPhotronReadout, configPhotronReadoutCallFunc);
+    iocshRegister(&configPhotronLargePages, configPhotronLargePagesCallFunc);
+    iocshRegister(&configPhotronCompress, configPhotronCompressCallFunc);
 }
 
 extern "C" {
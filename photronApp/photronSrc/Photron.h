@@ -9,12 +9,57 @@
 #define NUM_SHADING_MODES 7
 #define MAX_ENUM_STRING_SIZE 26
 #define NUM_VAR_CHANS 20
+#define NUM_IRIG_SAMPLES 64
+// Number of preview ranges that can be saved from one recording
+#define MAX_SAVE_RANGES 16
+// Number of recordings the random trigger modes can store in memory
+#define MAX_RECORDINGS 10
+// Frames of a camera that can be in the compression pool at once
+#define COMPRESS_MAX_PENDING 32
 
 typedef struct {
   int value;
   char string[MAX_ENUM_STRING_SIZE];
 } enumStruct_t;
 
+class Photron;
+
+/* A readout waiting for, or holding, a slot of the readout scheduler */
+typedef struct {
+  ELLNODE node;
+  Photron *pCamera;
+  int priority;
+  int share;
+  epicsEventId goEventId;
+} readoutJob;
+
+/* A frame being compressed by the compression pool. seq orders the frames 
+   of a camera, so they are published in the order they were read. */
+typedef struct {
+  ELLNODE node;
+  Photron *pCamera;
+  NDArray *pArray;
+  int addr;
+  int codec;
+  epicsUInt32 seq;
+} compressJob;
+
+/* Camera settings that are restored when the camera reconnects */
+typedef struct {
+  int valid;
+  int camMode;
+  int recRate;
+  int sizeX;
+  int sizeY;
+  int triggerMode;
+  int afterFrames;
+  int randomFrames;
+  int recCount;
+  int extInMode[PDC_EXTIO_MAX_PORT];
+  int extOutMode[PDC_EXTIO_MAX_PORT];
+  int varChan;
+} cameraConfig;
+
 static const char *triggerModeStrings[NUM_TRIGGER_MODES] = {
   "Start",
   "Center",
@@ -100,6 +145,20 @@ static const char *shadingModeStrings[NUM_SHADING_MODES] = {
   "Load File"
 };
 
+/** Pool of the arrays of a readout. It signals releaseEventId whenever one
+ * of its arrays is released, so a lossless readout that waits for the 
+ * plugins wakes up as soon as they return a buffer.
+ */
+class PhotronArrayPool : public NDArrayPool {
+public:
+  PhotronArrayPool(asynNDArrayDriver *pDriver, size_t maxMemory, 
+                   epicsEventId releaseEventId);
+protected:
+  virtual void onReleaseArray(NDArray *pArray);
+private:
+  epicsEventId releaseEventId;
+};
+
 /** Main driver class inherited from areaDetector's ADDriver class.
  * One instance of this class will control one camera.
  */
@@ -107,7 +166,8 @@ class epicsShareClass Photron : public ADDriver {
 public:
   /* Constructor and Destructor */
   Photron(const char *portName, const char *ipAddress, int autoDetect,
-          int maxBuffers, size_t maxMemory, int priority, int stackSize);
+          int maxBuffers, size_t maxMemory, int priority, int stackSize,
+          int maxHeads);
   ~Photron();
 
   /* These methods are overwritten from asynPortDriver */
@@ -126,9 +186,18 @@ public:
   void PhotronWaitTask(); 
   void PhotronRecTask(); 
   void PhotronPlayTask(); 
+  void PhotronGrabTask(); 
+  void PhotronPrefetchTask();
+  void PhotronConnectTask();
+  void PhotronSupervisorTask();
+  void PhotronPollTask();
+  void PhotronCaptureTask();
   
   /* These are called from C and so must be public */
   static void shutdown(void *arg);
+  asynStatus armForGroup();
+  static void syncGroup(int group, int trigger);
+  void compressJobDone(compressJob *pJob);
   
 protected:
     int PhotronStatus;          /** Camera status                             (int32 read) */
@@ -222,7 +291,7 @@ protected:
     int PhotronPMCancel;        /** Exit preview mode without saving images   (int32 write) */
     int PhotronPMPlayFPS;       /** Updates per second during playback        (int32 read/write) */
     int PhotronPMPlayMult;      /** Images per update during playback         (int32 read/write) */
-    int PhotronPMRepeat;        /** Enable or disable repeat during playback  (int32 write) */
+    int PhotronPMRepeat;        /** Off, loop or ping-pong during playback    (int32 write) */
     int PhotronIRIG;            /** Enable or disable the use of IRIG 
                                     timecodes when AcquireMode is Record      (int32 read/write) */
     int PhotronMemIRIGDay;      /** Day of year from timecode for current frame (int32 read) */
@@ -244,8 +313,82 @@ protected:
     int PhotronShadingMode;     /** Turning the shading mode off and on
                                     performs the black-level calibration      (int32 read/write) */
     int PhotronBurstTrans;      /** Enable or disable burst-transfer mode     (int32 read/write) */
+    int PhotronReadoutLossless; /** Wait for free buffers instead of dropping
+                                    frames during readout                     (int32 read/write) */
+    int PhotronReadoutMaxInFlight; /** Max number of arrays held by plugins
+                                    before lossless readout stalls            (int32 read/write) */
+    int PhotronReadoutStallTime;/** Time spent waiting for plugins during
+                                    the current readout (seconds)             (float64 read) */
+    int PhotronReadoutStalls;   /** Number of stalls during current readout   (int32 read) */
+    int PhotronReadoutDropped;  /** Frames of the current readout dropped 
+                                    for lack of a buffer                      (int32 read) */
+    int PhotronReadoutReserve;  /** Number of buffers to reserve in the pool
+                                    before reading out a recording            (int32 read/write) */
+    int PhotronReadoutReservedBytes; /** Bytes currently reserved for readout (float64 read) */
+    int PhotronLiveGrabber;     /** Grab live images in a separate thread     (int32 read/write) */
+    int PhotronLiveGrabRate;    /** Rate at which live images are grabbed     (float64 read) */
+    int PhotronLiveDropped;     /** Live images replaced before publishing    (int32 read) */
+    int PhotronLiveFrameNumbers;/** Read numbered live images from the
+                                    SDK's live image buffer                   (int32 read/write) */
+    int PhotronLiveFrameNo;     /** Camera frame number of last live image    (int32 read) */
+    int PhotronLiveDeliveredRate; /** Rate of new live images (fps)           (float64 read) */
+    int PhotronLiveSensorRate;  /** Rate of camera frames during live (fps)   (float64 read) */
+    int PhotronLiveSkipped;     /** Camera frames skipped between live images (int32 read) */
+    int PhotronIRIGResidual;    /** RMS residual of the IRIG clock model (s)  (float64 read) */
+    int PhotronIRIGDrift;       /** Drift of the IRIG clock relative to the
+                                    host clock (ppm)                          (float64 read) */
+    int PhotronTrigTime;        /** User-supplied time of the trigger frame
+                                    (seconds past the EPICS epoch)            (float64 read/write) */
+    int PhotronFrameTimeSource; /** What the recorded frame times are
+                                    anchored to                               (int32 read) */
+    int PhotronPMCacheBudget;   /** Memory for caching preview frames (MB)    (int32 read/write) */
+    int PhotronPMCacheUsed;     /** Memory used by cached frames (MB)         (float64 read) */
+    int PhotronPMCacheHitRate;  /** Percentage of preview frames from cache   (float64 read) */
+    int PhotronPMPrefetchAhead; /** Frames to prefetch in the play direction  (int32 read/write) */
+    int PhotronPMPrefetchBehind;/** Frames to prefetch behind the index       (int32 read/write) */
+    int PhotronPMAchievedFPS;   /** Frames per second actually played back    (float64 read) */
+    int PhotronPMSkipped;       /** Frames skipped to keep up with PMPlayFPS  (int32 read) */
+    int PhotronPMAddRange;      /** Add the preview range to the save list    (int32 write) */
+    int PhotronPMClearRanges;   /** Empty the save list                       (int32 write) */
+    int PhotronPMNumRanges;     /** Number of ranges in the save list         (int32 read) */
+    int PhotronPMRangeFrames;   /** Number of frames in the save list         (int32 read) */
+    int PhotronNumRecordings;   /** Number of recordings in memory            (int32 read) */
+    int PhotronSplitRecordings; /** Read each recording as an acquisition     (int32 read/write) */
+    int PhotronSyncGroup;       /** Group of cameras armed and triggered 
+                                    together (0 = none)                       (int32 read/write) */
+    int PhotronGroupArm;        /** Arm all cameras in the group              (int32 write) */
+    int PhotronGroupTrigger;    /** Arm and trigger all cameras in the group  (int32 write) */
+    int PhotronGroupArmTime;    /** Time to arm the group (ms)                (float64 read) */
+    int PhotronGroupTrigSkew;   /** Time between first and last trigger (us)  (float64 read) */
+    int PhotronGroupStatus;     /** Result of the last GroupArm/GroupTrigger  (int32 read) */
+    int PhotronReadoutPriority; /** Readouts with higher priority start first (int32 read/write) */
+    int PhotronReadoutShare;    /** Share of the readout bandwidth            (int32 read/write) */
+    int PhotronReadoutWaitTime; /** Time spent waiting for a readout slot (s) (float64 read) */
+    int PhotronReadoutMBps;     /** Readout throughput of this camera         (float64 read) */
+    int PhotronReadoutTotalMBps;/** Readout throughput of all cameras         (float64 read) */
+    int PhotronConnectTime;     /** Time taken to connect to the camera (s)   (float64 read) */
+    int PhotronConnectState;    /** Disconnected, connecting or connected     (int32 read) */
+    int PhotronAutoReconnect;   /** Reconnect when the link is lost           (int32 read/write) */
+    int PhotronReconnectCount;  /** Number of automatic reconnects            (int32 read) */
+    int PhotronDowntime;        /** Duration of the current/last outage (s)   (float64 read) */
+    int PhotronNumHeads;        /** Number of camera heads in use             (int32 read) */
+    int PhotronCorrMode;        /** Frame correction: off, dark, dark+flat    (int32 read/write) */
+    int PhotronCorrOutput;      /** Corrected data type: UInt16 or Float32    (int32 read/write) */
+    int PhotronCorrFrames;      /** Frames averaged for a reference           (int32 read/write) */
+    int PhotronCorrCaptureDark; /** Capture a dark reference                  (int32 write) */
+    int PhotronCorrCaptureFlat; /** Capture a flat reference                  (int32 write) */
+    int PhotronCorrClear;       /** Discard all references                    (int32 write) */
+    int PhotronCorrHaveDark;    /** Dark reference exists for the resolution  (int32 read) */
+    int PhotronCorrHaveFlat;    /** Flat reference exists for the resolution  (int32 read) */
+    int PhotronCorrTime;        /** Time to correct the last frame (ms)       (float64 read) */
+    int PhotronPixelGainCorr;   /** Apply the camera's pixel gain table       (int32 read/write) */
+    int PhotronPixelGainLoaded; /** Pixel gain table cached for the resolution (int32 read) */
+    int PhotronCompress;        /** Codec of the published frames             (int32 read/write) */
+    int PhotronCompressRatio;   /** Compression ratio                         (float64 read) */
+    int PhotronCompressSpeed;   /** Compression speed of one thread (MB/s)    (float64 read) */
+    int PhotronCompressThreads; /** Threads of the compression pool           (int32 read) */
     #define FIRST_PHOTRON_PARAM PhotronStatus
-    #define LAST_PHOTRON_PARAM PhotronBurstTrans
+    #define LAST_PHOTRON_PARAM PhotronCompressThreads
     
     int* PhotronExtInSig[PDC_EXTIO_MAX_PORT];
     int* PhotronExtOutSig[PDC_EXTIO_MAX_PORT];
@@ -254,6 +397,11 @@ private:
   /* These are the methods that are new to this class */
   asynStatus disconnectCamera();
   asynStatus connectCamera();
+  asynStatus openCamera();
+  asynStatus openDevice(unsigned long ipNumHost);
+  asynStatus findHeads();
+  asynStatus readHeadGeometry();
+  asynStatus writeHeadInt32(asynUser *pasynUser, int addr, epicsInt32 value);
   asynStatus getCameraInfo();
   asynStatus updateResolution();
   asynStatus setValidWidth(epicsInt32 value);
@@ -265,6 +413,12 @@ private:
   asynStatus readParameters();
   asynStatus readVariableInfo();
   asynStatus readImage();
+  asynStatus grabLiveImage(NDArray **ppImage, int skipDuplicate);
+  asynStatus transferLiveImage(NDArray **ppImage, int skipDuplicate);
+  void waitForGrab();
+  void waitForArm();
+  void updateLiveFrameStats(unsigned long frameNo);
+  asynStatus readLatestImage();
   asynStatus readMemImage(epicsInt32 value);
   asynStatus readImageRange();
   asynStatus setTransferOption();
@@ -298,6 +452,19 @@ private:
   asynStatus setPixelFormat();
   asynStatus setTriggerMode();
   asynStatus softwareTrigger();
+  static void queueGroupRequest(int group, int trigger);
+  asynStatus acquireReadoutSlot();
+  void releaseReadoutSlot();
+  void throttleReadout(size_t bytes);
+  void publishArray(NDArray *pImage, int addr);
+  NDArray *compressArray(NDArray *pIn, int codec);
+  void updateCompressStats(int force);
+  void flushCompression(double timeout);
+  void checkLinkError(unsigned long nErrorCode);
+  void pollLinkStatus();
+  void handleLinkLoss();
+  void saveCameraConfig();
+  asynStatus restoreCameraConfig();
   asynStatus setRecReady();
   asynStatus setEndless();
   asynStatus setLive();
@@ -313,6 +480,13 @@ private:
   asynStatus setExternalOutMode(epicsInt32 port, epicsInt32 value);
   asynStatus setShadingMode(epicsInt32 value);
   asynStatus setBurstTransfer(epicsInt32 value);
+  asynStatus waitForReadoutBuffer(double *stallTime, int force);
+  asynStatus reserveReadoutBuffers();
+  asynStatus releaseReadoutBuffers();
+  NDArray *allocReadoutArray(int ndims, size_t *dims, NDDataType_t dataType, 
+                             size_t dataSize);
+  NDArray *allocOutputArray(NDArray *pRaw, int ndims, size_t *dims, 
+                            NDDataType_t dataType);
   int statusToEPICS(int apiStatus);
   int trigModeToEPICS(int apiMode);
   int trigModeToAPI(int mode);
@@ -326,6 +500,38 @@ private:
   asynStatus createDynamicEnums();
   void timeDiff(PPDC_IRIG_INFO time1, PPDC_IRIG_INFO time2, PPDC_IRIG_INFO timeDiff);
   void timeDataToSec(PPDC_IRIG_INFO tData, double *seconds);
+  void timeDataToTimeStamp(PPDC_IRIG_INFO tData, epicsTimeStamp *pTimeStamp);
+  void resetIRIGModel();
+  void addIRIGSample(PPDC_IRIG_INFO tData, epicsTimeStamp *pBefore, 
+                     epicsTimeStamp *pAfter);
+  void fitIRIGModel();
+  asynStatus readFrameData();
+  void releaseFrameData();
+  void addFrameAttributes(NDArray *pImage, long frameNo);
+  void setFrameTimeAnchor();
+  void findRecordings(unsigned long memTrigMode, unsigned long memAFrames,
+                      unsigned long memRFrames, unsigned long memRCount);
+  int frameRecording(long frameNo);
+  void frameTimeToTimeStamp(long frameNo, epicsTimeStamp *pTimeStamp);
+  struct previewCacheEntry *previewCacheFind(long frameNo, size_t size);
+  int previewCacheGet(long frameNo, void *pData, size_t size, PDC_IRIG_INFO *pTData);
+  void previewCachePut(long frameNo, const void *pData, size_t size, PDC_IRIG_INFO *pTData);
+  void previewCacheTrim(size_t maxBytes);
+  void previewCacheClear();
+  void updatePreviewCacheParams();
+  void requestPrefetch(long frameNo);
+  void waitForPrefetch();
+  struct correctionRef *findCorrectionRef(int width, int height, int create);
+  asynStatus captureCorrectionRef(int flat);
+  void clearCorrectionRefs(int keepPixelGain);
+  asynStatus loadPixelGain(int reload);
+  void updateCorrectionParams();
+  NDArray *correctFrame(NDArray *pRaw, double *pStallTime);
+  NDArray *convertColor(NDArray *pRaw, int *pColorMode, double *pStallTime);
+  void buildPlaySchedule();
+  int advancePlaySchedule(int index, int steps, int *pNext);
+  void addSaveRange();
+  void clearSaveRanges();
   asynStatus findNearestValue(epicsInt32* pValue, int* pListIndex, unsigned long listSize, unsigned long* listName);
   int changeListIndex(epicsInt32 value, unsigned long listIndex, unsigned long listSize);
   int findListIndex(epicsInt32 value, unsigned long listSize, unsigned long* listName);
@@ -343,9 +549,25 @@ private:
   epicsEventId resumeRecEventId;
   epicsEventId startPlayEventId;
   epicsEventId stopPlayEventId;
+  epicsEventId freeBufferEventId;
+  epicsEventId startGrabEventId;
+  epicsEventId liveFrameEventId;
+  epicsEventId prefetchEventId;
+  epicsEventId prefetchIdleEventId;
+  epicsEventId grabIdleEventId;
+  epicsEventId armIdleEventId;
+  epicsEventId connectEventId;
+  epicsEventId supervisorEventId;
+  epicsEventId pollEventId;
+  epicsEventId pollDoneEventId;
   // connectCamera
   unsigned long nDeviceNo;
-  unsigned long nChildNo;   // hard-coded to 1 in connectCamera
+  unsigned long nChildNo;   // the first head; set by findHeads
+  // Head h of a multi-head system is child device headChildNo[h] and asyn 
+  // address h
+  int maxHeads;
+  int numHeads;
+  unsigned long headChildNo[PDC_MAX_CHILD_DEVICE];
   // getCameraInfo
   char functionList[98];   /* Indices (functions) range from 2 to 97 */
   unsigned long deviceCode;
@@ -360,6 +582,8 @@ private:
   unsigned long sensorWidth;
   unsigned long sensorHeight;
   unsigned long sensorBits;
+  unsigned long colorType;
+  int bayerPattern;
   unsigned long inPorts;
   unsigned long outPorts;
   unsigned long ExtInMode[PDC_EXTIO_MAX_PORT];
@@ -423,8 +647,26 @@ private:
   int desiredRate;
   // readMem
   epicsInt32 NDArrayCounterBackup;
+  size_t reservedBytes;
+  // The reserved buffers have their own pool, so they can be freed without
+  // touching the driver's pool. The other arrays of a readout come from 
+  // pReadoutPool, so only readout arrays are counted as in flight.
+  PhotronArrayPool *pReservePool;
+  PhotronArrayPool *pReadoutPool;
+  size_t reserveBufferSize;
+  // Newest live image from the grab task that hasn't been published yet
+  NDArray *liveLatest;
+  epicsMutexId liveMutex;
+  // Camera frame numbers of live images
+  int liveFrameValid;
+  unsigned long liveFrameNo;
+  unsigned long liveRateFrameNo;
+  int liveRateCount;
+  epicsTimeStamp liveRateTime;
   unsigned long memWidth;
   unsigned long memHeight;
+  unsigned long headMemWidth[PDC_MAX_CHILD_DEVICE];
+  unsigned long headMemHeight[PDC_MAX_CHILD_DEVICE];
   unsigned long memRate;
   unsigned long tMode;
   PDC_IRIG_INFO tDataStart;
@@ -433,6 +675,112 @@ private:
   //
   epicsTimeStamp preIRIGStartTime;
   epicsTimeStamp postIRIGStartTime;
+  // IRIG clock model: host = irigRefHost + irigOffset + (irig - irigRefSec) * irigSlope
+  epicsTimeStamp irigRefHost;
+  double irigRefSec;
+  double irigOffset;
+  double irigSlope;
+  double irigSampleX[NUM_IRIG_SAMPLES];
+  double irigSampleY[NUM_IRIG_SAMPLES];
+  int irigNumSamples;
+  int irigNextSample;
+  epicsTimeStamp irigLastSampleTime;
+  // Per-frame data for the recording in memory
+  long frameDataStart;
+  long frameDataCount;
+  PDC_MCDL_INFO *mcdlData;
+  UINT32 *exposeData;
+  unsigned long exposeDataCount;
+  // Frame time model for recordings without IRIG
+  epicsTimeStamp recStartTime;
+  epicsTimeStamp recEndTime;
+  int recStartValid;
+  epicsTimeStamp frameAnchorTime;
+  long frameAnchorFrame;
+  // Preview frames, most recently used first
+  ELLLIST previewCache;
+  size_t previewCacheBytes;
+  unsigned long previewCacheHits;
+  unsigned long previewCacheMisses;
+  // Dark and flat references for the frame correction, one per resolution
+  ELLLIST correctionRefs;
+  // Held while references are used without the lock; they are replaced 
+  // with both the lock and corrMutex held
+  epicsMutexId corrMutex;
+  // Row buffer of the demosaic, kept between frames. colorMutex is held 
+  // while it is used without the lock.
+  epicsMutexId colorMutex;
+  void *colorScratch;
+  size_t colorScratchSize;
+  // Reference captures run in PhotronCaptureTask; captureFunction is the
+  // command being run while captureBusy is set
+  epicsEventId captureEventId;
+  int captureBusy;
+  int captureFunction;
+  // Frames around prefetchIndex are read into the cache in the background.
+  // Incrementing prefetchGeneration cancels the pass in progress.
+  // prefetchBusy is set while a frame is transferred without the lock.
+  long prefetchIndex;
+  int prefetchDir;
+  unsigned long prefetchGeneration;
+  int prefetchBusy;
+  // Number of live transfers in progress without the lock. Changes of the 
+  // resolution or pixel format wait for them with waitForGrab.
+  int grabBusy;
+  int playActive;
+  // Playback schedule; rebuilt by the play task when a playback parameter 
+  // changes, so the per-frame work doesn't read the parameter library
+  int playStart;
+  int playEnd;
+  int playStride;
+  int playFps;
+  int playRepeat;
+  int playDir;
+  int playScheduleChanged;
+  // Preview ranges to read out when the preview is saved
+  int saveRangeStart[MAX_SAVE_RANGES];
+  int saveRangeEnd[MAX_SAVE_RANGES];
+  int numSaveRanges;
+  // Recordings stored in memory by the random trigger modes
+  int numRecordings;
+  long recordingStart[MAX_RECORDINGS];
+  long recordingEnd[MAX_RECORDINGS];
+  long recordingEvent[MAX_RECORDINGS];
+  epicsTimeStamp recordingTrigTime[MAX_RECORDINGS];
+  // Readout scheduling
+  readoutJob readoutSlot;
+  double readoutRate;
+  double readoutRateBytes;
+  epicsTimeStamp readoutRateTime;
+  epicsTimeStamp readoutPaceTime;
+  // Compression of the published frames
+  int compressCodec;
+  epicsMutexId compressMutex;
+  epicsEventId compressSpaceEventId;
+  epicsUInt32 compressSubmitSeq;
+  epicsUInt32 compressPublishSeq;
+  int compressPublishing;
+  compressJob *compressRing[COMPRESS_MAX_PENDING];
+  double compressBytesIn;
+  double compressBytesOut;
+  double compressSeconds;
+  epicsTimeStamp compressStatsTime;
+  // Connection supervisor
+  int cameraConnected;
+  // Set while connectCamera runs, which is partly without the lock
+  int connecting;
+  // Set while armForGroup polls the camera status without the lock
+  int armBusy;
+  // Result of the link poll, which PhotronPollTask makes without the lock.
+  // pollBusy stays set if the poll doesn't return.
+  int pollBusy;
+  unsigned long pollRet;
+  unsigned long pollErrorCode;
+  int linkLost;
+  int restorePending;
+  double reconnectDelay;
+  epicsTimeStamp linkLostTime;
+  cameraConfig savedConfig;
   int abortFlag;
   //
   int stopFlag;
@@ -460,12 +808,43 @@ static void PhotronTaskC(void *drvPvt);
 static void PhotronWaitTaskC(void *drvPvt);
 static void PhotronRecTaskC(void *drvPvt);
 static void PhotronPlayTaskC(void *drvPvt);
+static void PhotronGrabTaskC(void *drvPvt);
+static void PhotronPrefetchTaskC(void *drvPvt);
+static void PhotronConnectTaskC(void *drvPvt);
+static void PhotronSupervisorTaskC(void *drvPvt);
+static void PhotronGroupTaskC(void *drvPvt);
+static void PhotronPollTaskC(void *drvPvt);
+static void PhotronCaptureTaskC(void *drvPvt);
 
 typedef struct {
   ELLNODE node;
   Photron *pCamera;
+  // Set once the constructor has completed; the connect task is started
+  // for these cameras when iocInit begins
+  int startConnect;
 } cameraNode;
 
+/* A frame from the camera's memory, cached for preview mode */
+typedef struct previewCacheEntry {
+  ELLNODE node;
+  long frameNo;
+  size_t size;
+  PDC_IRIG_INFO tData;
+  void *pData;
+} previewCacheEntry;
+
+/* The dark and flat references and the camera's pixel gain table of one 
+   resolution for the frame correction. The gains have CORR_GAIN_SHIFT 
+   fraction bits. */
+typedef struct correctionRef {
+  ELLNODE node;
+  int width;
+  int height;
+  epicsUInt16 *pDark;
+  epicsUInt16 *pGain;
+  epicsUInt16 *pPixelGain;
+} correctionRef;
+
 // Define param strings here
 #define PhotronStatusString           "PHOTRON_STATUS"
 #define PhotronStatusNameString       "PHOTRON_STATUS_NAME"
@@ -552,6 +931,70 @@ typedef struct {
 #define PhotronExtOut4SigString       "PHOTRON_EXT_OUT_4_SIG"
 #define PhotronShadingModeString      "PHOTRON_SHADING_MODE"
 #define PhotronBurstTransString       "PHOTRON_BURST_TRANS"
+#define PhotronReadoutLosslessString  "PHOTRON_READOUT_LOSSLESS"
+#define PhotronReadoutMaxInFlightString "PHOTRON_READOUT_MAX_IN_FLIGHT"
+#define PhotronReadoutStallTimeString "PHOTRON_READOUT_STALL_TIME"
+#define PhotronReadoutStallsString    "PHOTRON_READOUT_STALLS"
+#define PhotronReadoutDroppedString   "PHOTRON_READOUT_DROPPED"
+#define PhotronReadoutReserveString   "PHOTRON_READOUT_RESERVE"
+#define PhotronReadoutReservedBytesString "PHOTRON_READOUT_RESERVED_BYTES"
+#define PhotronLiveGrabberString      "PHOTRON_LIVE_GRABBER"
+#define PhotronLiveGrabRateString     "PHOTRON_LIVE_GRAB_RATE"
+#define PhotronLiveDroppedString      "PHOTRON_LIVE_DROPPED"
+#define PhotronLiveFrameNumbersString "PHOTRON_LIVE_FRAME_NUMBERS"
+#define PhotronLiveFrameNoString      "PHOTRON_LIVE_FRAME_NO"
+#define PhotronLiveDeliveredRateString "PHOTRON_LIVE_DELIVERED_RATE"
+#define PhotronLiveSensorRateString   "PHOTRON_LIVE_SENSOR_RATE"
+#define PhotronLiveSkippedString      "PHOTRON_LIVE_SKIPPED"
+#define PhotronIRIGResidualString     "PHOTRON_IRIG_RESIDUAL"
+#define PhotronIRIGDriftString        "PHOTRON_IRIG_DRIFT"
+#define PhotronTrigTimeString         "PHOTRON_TRIG_TIME"
+#define PhotronFrameTimeSourceString  "PHOTRON_FRAME_TIME_SOURCE"
+#define PhotronPMCacheBudgetString    "PHOTRON_PM_CACHE_BUDGET"
+#define PhotronPMCacheUsedString      "PHOTRON_PM_CACHE_USED"
+#define PhotronPMCacheHitRateString   "PHOTRON_PM_CACHE_HIT_RATE"
+#define PhotronPMPrefetchAheadString  "PHOTRON_PM_PREFETCH_AHEAD"
+#define PhotronPMPrefetchBehindString "PHOTRON_PM_PREFETCH_BEHIND"
+#define PhotronPMAchievedFPSString    "PHOTRON_PM_ACHIEVED_FPS"
+#define PhotronPMSkippedString        "PHOTRON_PM_SKIPPED"
+#define PhotronPMAddRangeString       "PHOTRON_PM_ADD_RANGE"
+#define PhotronPMClearRangesString    "PHOTRON_PM_CLEAR_RANGES"
+#define PhotronPMNumRangesString      "PHOTRON_PM_NUM_RANGES"
+#define PhotronPMRangeFramesString    "PHOTRON_PM_RANGE_FRAMES"
+#define PhotronNumRecordingsString    "PHOTRON_NUM_RECORDINGS"
+#define PhotronSplitRecordingsString  "PHOTRON_SPLIT_RECORDINGS"
+#define PhotronSyncGroupString        "PHOTRON_SYNC_GROUP"
+#define PhotronGroupArmString         "PHOTRON_GROUP_ARM"
+#define PhotronGroupTriggerString     "PHOTRON_GROUP_TRIGGER"
+#define PhotronGroupArmTimeString     "PHOTRON_GROUP_ARM_TIME"
+#define PhotronGroupTrigSkewString    "PHOTRON_GROUP_TRIG_SKEW"
+#define PhotronGroupStatusString      "PHOTRON_GROUP_STATUS"
+#define PhotronReadoutPriorityString  "PHOTRON_READOUT_PRIORITY"
+#define PhotronReadoutShareString     "PHOTRON_READOUT_SHARE"
+#define PhotronReadoutWaitTimeString  "PHOTRON_READOUT_WAIT_TIME"
+#define PhotronReadoutMBpsString      "PHOTRON_READOUT_MBPS"
+#define PhotronReadoutTotalMBpsString "PHOTRON_READOUT_TOTAL_MBPS"
+#define PhotronConnectTimeString      "PHOTRON_CONNECT_TIME"
+#define PhotronConnectStateString     "PHOTRON_CONNECT_STATE"
+#define PhotronAutoReconnectString    "PHOTRON_AUTO_RECONNECT"
+#define PhotronReconnectCountString   "PHOTRON_RECONNECT_COUNT"
+#define PhotronDowntimeString         "PHOTRON_DOWNTIME"
+#define PhotronNumHeadsString         "PHOTRON_NUM_HEADS"
+#define PhotronCorrModeString         "PHOTRON_CORR_MODE"
+#define PhotronCorrOutputString       "PHOTRON_CORR_OUTPUT"
+#define PhotronCorrFramesString       "PHOTRON_CORR_FRAMES"
+#define PhotronCorrCaptureDarkString  "PHOTRON_CORR_CAPTURE_DARK"
+#define PhotronCorrCaptureFlatString  "PHOTRON_CORR_CAPTURE_FLAT"
+#define PhotronCorrClearString        "PHOTRON_CORR_CLEAR"
+#define PhotronCorrHaveDarkString     "PHOTRON_CORR_HAVE_DARK"
+#define PhotronCorrHaveFlatString     "PHOTRON_CORR_HAVE_FLAT"
+#define PhotronCorrTimeString         "PHOTRON_CORR_TIME"
+#define PhotronPixelGainCorrString    "PHOTRON_PIXEL_GAIN_CORR"
+#define PhotronPixelGainLoadedString  "PHOTRON_PIXEL_GAIN_LOADED"
+#define PhotronCompressString         "PHOTRON_COMPRESS"
+#define PhotronCompressRatioString    "PHOTRON_COMPRESS_RATIO"
+#define PhotronCompressSpeedString    "PHOTRON_COMPRESS_SPEED"
+#define PhotronCompressThreadsString  "PHOTRON_COMPRESS_THREADS"
 
 /** Number of asynPortDriver parameters this driver supports. */
 #define NUM_PHOTRON_PARAMS ((int)(&LAST_PHOTRON_PARAM-&FIRST_PHOTRON_PARAM+1))